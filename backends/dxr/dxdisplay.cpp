@@ -168,6 +168,11 @@ void DXDisplay::display(RenderBackend *renderer)
     }
 }
 
+bool DXDisplay::needs_readback(RenderBackend *renderer)
+{
+    return dynamic_cast<RenderDXR *>(renderer) == nullptr;
+}
+
 void DXDisplay::display_native(dxr::Texture2D &img)
 {
     CHECK_ERR(cmd_allocator->Reset());
@@ -47,6 +47,8 @@ struct DXDisplay : Display {
 
     void display(RenderBackend *renderer) override;
 
+    bool needs_readback(RenderBackend *renderer) override;
+
     void display_native(dxr::Texture2D &img);
 
 private:
@@ -106,8 +106,9 @@ void RenderDXR::initialize(const int fb_width, const int fb_height)
     }
 }
 
-void RenderDXR::set_scene(const Scene &scene)
+void RenderDXR::set_scene(const std::shared_ptr<const Scene> &in_scene)
 {
+    const Scene &scene = *in_scene;
     frame_id = 0;
     samples_per_pixel = scene.samples_per_pixel;
 
@@ -124,7 +125,7 @@ void RenderDXR::set_scene(const Scene &scene)
             // into a default heap (resident in VRAM)
             dxr::Buffer upload_verts =
                 dxr::Buffer::upload(device.Get(),
-                                    geom.vertices.size() * sizeof(glm::vec3),
+                                    geom.num_vertices() * sizeof(glm::vec3),
                                     D3D12_RESOURCE_STATE_GENERIC_READ);
             dxr::Buffer upload_indices =
                 dxr::Buffer::upload(device.Get(),
@@ -334,15 +335,18 @@ void RenderDXR::set_scene(const Scene &scene)
                                                      tex.linear_row_pitch() * t.height,
                                                      D3D12_RESOURCE_STATE_GENERIC_READ);
 
+        std::vector<uint8_t> rgba_scratch;
+        const uint8_t *pixels = rgba8_pixels(t, rgba_scratch);
+
         // TODO: Some better texture upload handling here, and readback for handling the row
         // pitch stuff
         if (tex.linear_row_pitch() == t.width * tex.pixel_size()) {
-            std::memcpy(tex_upload.map(), t.img.data(), tex_upload.size());
+            std::memcpy(tex_upload.map(), pixels, tex_upload.size());
         } else {
             uint8_t *buf = static_cast<uint8_t *>(tex_upload.map());
             for (uint32_t y = 0; y < t.height; ++y) {
                 std::memcpy(buf + y * tex.linear_row_pitch(),
-                            t.img.data() + y * t.width * tex.pixel_size(),
+                            pixels + y * t.width * tex.pixel_size(),
                             t.width * tex.pixel_size());
             }
         }
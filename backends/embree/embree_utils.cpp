@@ -2,30 +2,40 @@
 #include <algorithm>
 #include <iterator>
 #include <limits>
+#include <stdexcept>
+#include <tbb/parallel_for.h>
 #include <glm/ext.hpp>
+#ifdef _WIN32
+#include <malloc.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#else
+#include <cstdlib>
+#endif
 
 namespace embree {
 
 Geometry::Geometry(RTCDevice &device,
-                   const std::vector<glm::vec3> &verts,
-                   const std::vector<glm::uvec3> &indices,
-                   const std::vector<glm::vec3> &normals,
-                   const std::vector<glm::vec2> &uvs)
-    : n_vertices(verts.size()),
-      vertex_buf(verts),
-      index_buf(indices),
-      normal_buf(normals),
-      uv_buf(uvs),
+                   const ::Geometry &mesh_geom,
+                   const RTCBuildQuality quality)
+    : n_vertices(mesh_geom.num_vertices()),
+      vertex_buf(mesh_geom.vertices.data()),
+      index_buf(mesh_geom.indices.data()),
+      n_indices(mesh_geom.indices.size()),
       geom(rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE))
 {
-    // Pad the vertex_buf out to align it
-    vertex_buf.push_back(glm::vec3(0.f));
+    if (!mesh_geom.normals.empty()) {
+        normal_buf = mesh_geom.normals.data();
+    }
+    if (!mesh_geom.uvs.empty()) {
+        uv_buf = mesh_geom.uvs.data();
+    }
 
     rtcSetSharedGeometryBuffer(geom,
                                RTC_BUFFER_TYPE_VERTEX,
                                0,
                                RTC_FORMAT_FLOAT3,
-                               vertex_buf.data(),
+                               vertex_buf,
                                0,
                                sizeof(glm::vec3),
                                n_vertices);
@@ -33,11 +43,12 @@ Geometry::Geometry(RTCDevice &device,
                                RTC_BUFFER_TYPE_INDEX,
                                0,
                                RTC_FORMAT_UINT3,
-                               index_buf.data(),
+                               index_buf,
                                0,
                                sizeof(glm::uvec3),
-                               index_buf.size());
+                               n_indices);
 
+    rtcSetGeometryBuildQuality(geom, quality);
     rtcCommitGeometry(geom);
 }
 
@@ -49,20 +60,22 @@ Geometry::~Geometry()
 }
 
 ISPCGeometry::ISPCGeometry(const Geometry &geom)
-    : vertex_buf(geom.vertex_buf.data()), index_buf(geom.index_buf.data())
+    : vertex_buf(geom.vertex_buf),
+      index_buf(geom.index_buf),
+      normal_buf(geom.normal_buf),
+      uv_buf(geom.uv_buf)
 {
-    if (!geom.normal_buf.empty()) {
-        normal_buf = geom.normal_buf.data();
-    }
-
-    if (!geom.uv_buf.empty()) {
-        uv_buf = geom.uv_buf.data();
-    }
 }
 
-TriangleMesh::TriangleMesh(RTCDevice &device, std::vector<std::shared_ptr<Geometry>> &geoms)
+TriangleMesh::TriangleMesh(RTCDevice &device,
+                           std::vector<std::shared_ptr<Geometry>> &geoms,
+                           const RTCBuildQuality quality,
+                           const RTCSceneFlags flags)
     : scene(rtcNewScene(device)), geometries(geoms)
 {
+    rtcSetSceneBuildQuality(scene, quality);
+    rtcSetSceneFlags(scene, flags);
+
     ispc_geometries.reserve(geometries.size());
     std::transform(geometries.begin(),
                    geometries.end(),
@@ -118,13 +131,21 @@ ISPCInstance::ISPCInstance(const Instance &instance)
 {
 }
 
-TopLevelBVH::TopLevelBVH(RTCDevice &device, const std::vector<std::shared_ptr<Instance>> &inst)
-    : handle(rtcNewScene(device)), instances(inst)
+TopLevelBVH::TopLevelBVH(RTCDevice &device,
+                         const std::vector<std::shared_ptr<Instance>> &inst,
+                         const RTCBuildQuality quality,
+                         const RTCSceneFlags flags)
+    : handle(rtcNewScene(device)), instances(inst), ispc_instances(inst.size())
 {
-    for (const auto &i : instances) {
-        rtcAttachGeometry(handle, i->handle);
-        ispc_instances.push_back(*i);
-    }
+    rtcSetSceneBuildQuality(handle, quality);
+    rtcSetSceneFlags(handle, flags);
+
+    // Attaching by ID is thread-safe, and keeps the instance IDs reported by Embree
+    // matching the order of ispc_instances
+    tbb::parallel_for(size_t(0), instances.size(), [&](size_t i) {
+        rtcAttachGeometryByID(handle, instances[i]->handle, i);
+        ispc_instances[i] = ISPCInstance(*instances[i]);
+    });
     rtcCommitScene(handle);
 }
 
@@ -135,8 +156,111 @@ TopLevelBVH::~TopLevelBVH()
     }
 }
 
-ISPCTexture2D::ISPCTexture2D(const Image &img)
-    : width(img.width), height(img.height), channels(img.channels), data(img.img.data())
+static bool is_pow2(const int x)
+{
+    return x > 0 && (x & (x - 1)) == 0;
+}
+
+ISPCTexture2D::ISPCTexture2D(const Image &img, const int num_levels, const bool tiled)
+    : width(img.width),
+      height(img.height),
+      channels(img.channels),
+      format(static_cast<int>(img.format)),
+      layout(tiled ? 1 : 0),
+      pow2(is_pow2(img.width) && is_pow2(img.height)),
+      num_levels(num_levels),
+      data(img.img.data())
+{
+}
+
+void tile_texture(Image &img)
+{
+    const int tiles_x = (img.width + 3) / 4;
+    const int tiles_y = (img.height + 3) / 4;
+    std::vector<uint8_t> tiled(size_t(tiles_x) * tiles_y * 16 * img.channels, 0);
+    tbb::parallel_for(0, img.height, [&](int y) {
+        for (int x = 0; x < img.width; ++x) {
+            const size_t tile = size_t(y / 4) * tiles_x + x / 4;
+            const size_t dst = tile * 16 + (y % 4) * 4 + x % 4;
+            const size_t src = size_t(y) * img.width + x;
+            std::copy(&img.img[src * img.channels],
+                      &img.img[src * img.channels] + img.channels,
+                      &tiled[dst * img.channels]);
+        }
+    });
+    img.img = std::move(tiled);
+}
+
+TileArena::~TileArena()
+{
+    release();
+}
+
+void TileArena::release()
+{
+    if (!data) {
+        return;
+    }
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    if (mmapped) {
+        munmap(data, capacity);
+    } else {
+        free(data);
+    }
+#endif
+    data = nullptr;
+    capacity = 0;
+    mmapped = false;
+}
+
+uint8_t *TileArena::reserve(const size_t size)
+{
+    if (size <= capacity) {
+        return data;
+    }
+    release();
+
+    const size_t huge_page_size = 2 * 1024 * 1024;
+    const size_t alloc_size = ((size + huge_page_size - 1) / huge_page_size) * huge_page_size;
+#ifdef _WIN32
+    data = static_cast<uint8_t *>(_aligned_malloc(alloc_size, VIEW_ALIGNMENT));
+#elif defined(__linux__)
+    void *ptr = mmap(nullptr,
+                     alloc_size,
+                     PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                     -1,
+                     0);
+    if (ptr == MAP_FAILED) {
+        ptr = mmap(
+            nullptr, alloc_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+        if (ptr != MAP_FAILED) {
+            madvise(ptr, alloc_size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    if (ptr != MAP_FAILED) {
+        data = static_cast<uint8_t *>(ptr);
+        mmapped = true;
+    }
+#else
+    void *ptr = nullptr;
+    if (posix_memalign(&ptr, VIEW_ALIGNMENT, alloc_size) == 0) {
+        data = static_cast<uint8_t *>(ptr);
+    }
+#endif
+    if (!data) {
+        throw std::runtime_error("Failed to allocate tile arena");
+    }
+    capacity = alloc_size;
+    return data;
+}
+
+uint8_t *TileArena::get()
 {
+    return data;
 }
 }
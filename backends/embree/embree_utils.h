@@ -6,28 +6,30 @@
 #include <embree4/rtcore.h>
 #include "lights.h"
 #include "material.h"
+#include "mesh.h"
 #include <glm/glm.hpp>
 
 namespace embree {
 
+/* The geometry's buffers are shared with the Scene's geometry, which must outlive it.
+ * Embree reads vertices with 16 byte loads so the vertex buffer must be readable past the
+ * last vertex, the Scene's geometry ends with a padding vertex for this.
+ */
 struct Geometry {
-    // vertex_buf is padded out by an extra vec3 for Embree's alignment requirements
-    // n_vertices = the real # of vertices, ie vertex_buf.size() - 1
     size_t n_vertices = 0;
-    std::vector<glm::vec3> vertex_buf;
-    std::vector<glm::uvec3> index_buf;
-    std::vector<glm::vec3> normal_buf;
-    std::vector<glm::vec2> uv_buf;
+    const glm::vec3 *vertex_buf = nullptr;
+    const glm::uvec3 *index_buf = nullptr;
+    const glm::vec3 *normal_buf = nullptr;
+    const glm::vec2 *uv_buf = nullptr;
+    size_t n_indices = 0;
 
     RTCGeometry geom = 0;
 
     Geometry() = default;
 
     Geometry(RTCDevice &device,
-             const std::vector<glm::vec3> &verts,
-             const std::vector<glm::uvec3> &indices,
-             const std::vector<glm::vec3> &normals,
-             const std::vector<glm::vec2> &uvs);
+             const ::Geometry &mesh_geom,
+             const RTCBuildQuality quality = RTC_BUILD_QUALITY_MEDIUM);
 
     ~Geometry();
 
@@ -54,7 +56,10 @@ public:
 
     TriangleMesh() = default;
 
-    TriangleMesh(RTCDevice &device, std::vector<std::shared_ptr<Geometry>> &geometries);
+    TriangleMesh(RTCDevice &device,
+                 std::vector<std::shared_ptr<Geometry>> &geometries,
+                 const RTCBuildQuality quality = RTC_BUILD_QUALITY_MEDIUM,
+                 const RTCSceneFlags flags = RTC_SCENE_FLAG_NONE);
 
     ~TriangleMesh();
 
@@ -99,7 +104,10 @@ struct TopLevelBVH {
     std::vector<ISPCInstance> ispc_instances;
 
     TopLevelBVH() = default;
-    TopLevelBVH(RTCDevice &device, const std::vector<std::shared_ptr<Instance>> &instances);
+    TopLevelBVH(RTCDevice &device,
+                const std::vector<std::shared_ptr<Instance>> &instances,
+                const RTCBuildQuality quality = RTC_BUILD_QUALITY_MEDIUM,
+                const RTCSceneFlags flags = RTC_SCENE_FLAG_NONE);
     ~TopLevelBVH();
 
     TopLevelBVH(const TopLevelBVH &) = delete;
@@ -110,12 +118,23 @@ struct ISPCTexture2D {
     int width = -1;
     int height = -1;
     int channels = -1;
+    // The TextureFormat of the data
+    int format = 0;
+    // 0 for row-major texels, 1 for 4x4 texel tiles (see tile_texture)
+    int layout = 0;
+    int pow2 = 0;
+    // The number of mip levels from this one down, stored in the following ISPCTexture2Ds
+    int num_levels = 1;
     const uint8_t *data = nullptr;
 
-    ISPCTexture2D(const Image &img);
+    ISPCTexture2D(const Image &img, const int num_levels = 1, const bool tiled = false);
     ISPCTexture2D() = default;
 };
 
+// Rearrange the uncompressed texture's texels into row-major 4x4 tiles, with the tiles at
+// the right and bottom edges padded out for textures which aren't a multiple of 4
+void tile_texture(Image &img);
+
 struct MaterialParams {
     glm::vec3 base_color = glm::vec3(0.9f);
     float metallic = 0;
@@ -147,14 +166,71 @@ struct SceneContext {
     ISPCTexture2D *textures;
     uint32_t num_lights;
     uint32_t samples_per_pixel;
+    uint32_t ao_samples;
+    float ao_distance;
+};
+
+struct PixelHistory {
+    // Distance to the first hit of the pixel's first sample, or negative for a miss
+    float depth;
+    uint32_t instance;
+    float num_frames;
+};
+
+struct Reprojection {
+    ViewParams view;
+    const float *color;
+    const PixelHistory *history;
+    float max_frames;
 };
 
 struct Tile {
     uint32_t x, y;
     uint32_t width, height;
     uint32_t fb_width, fb_height;
-    float *data;
+    // The AccumulationFormat of the data
+    uint32_t accumulation_format;
+    void *data;
     uint16_t *ray_stats;
+    // The cached first hits for each pixel's fixed jitter positions, or null if the cache
+    // isn't in use
+    void *primary_hits;
+    uint32_t primary_hit_jitters;
+    // The history of each pixel if reprojection is enabled, otherwise null
+    PixelHistory *history;
+    // Set on the first frame after the camera moves to reproject the previous image from
+    const Reprojection *reprojection;
+    // The framebuffer's per-pixel sample density, or null to sample uniformly
+    const float *sample_density;
+};
+
+/* A single allocation holding the per-tile buffers, which the tiles take views into. On
+ * Linux it's backed by explicit huge pages if any are reserved, and otherwise marked for
+ * transparent huge pages, to cut down on TLB misses for large framebuffers. The arena
+ * only grows, so resizing to a framebuffer which fits in it doesn't reallocate.
+ */
+class TileArena {
+    uint8_t *data = nullptr;
+    size_t capacity = 0;
+    bool mmapped = false;
+
+    void release();
+
+public:
+    // Alignment of the views into the arena, so tiles don't share cache lines
+    static const size_t VIEW_ALIGNMENT = 64;
+
+    TileArena() = default;
+    ~TileArena();
+
+    TileArena(const TileArena &) = delete;
+    TileArena &operator=(const TileArena &) = delete;
+
+    // Make sure the arena holds at least size bytes and return it. The contents are not
+    // preserved if the arena has to grow
+    uint8_t *reserve(const size_t size);
+
+    uint8_t *get();
 };
 
 }
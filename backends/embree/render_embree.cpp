@@ -1,17 +1,27 @@
 #include "render_embree.h"
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cstring>
 #include <iostream>
 #include <limits>
+#include <mutex>
 #include <numeric>
 #include <tbb/global_control.h>
+#include <tbb/enumerable_thread_specific.h>
 #include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
 #ifndef __aarch64__
 #include <pmmintrin.h>
 #include <xmmintrin.h>
 #endif
 #include <util.h>
+#include "checkpoint.h"
 #include "render_embree_ispc.h"
+#include "texture_compression.h"
+#include "tiled_image_file.h"
 #include <glm/ext.hpp>
 
 static std::unique_ptr<tbb::global_control> tbb_thread_config;
@@ -35,120 +45,440 @@ std::string RenderEmbree::name()
     return "Embree (w/ TBB & ISPC)";
 }
 
+bool RenderEmbree::supports_render_thread()
+{
+    return true;
+}
+
+bool RenderEmbree::supports_feature(const RenderFeature feature)
+{
+    switch (feature) {
+    case RenderFeature::FRAME_TIME_BUDGET:
+    case RenderFeature::BVH_OPTIONS:
+    case RenderFeature::COMPRESSED_TEXTURES:
+    case RenderFeature::TEXTURE_MIPMAPS:
+    case RenderFeature::ACCUMULATION_FORMAT:
+    case RenderFeature::PRIMARY_HIT_CACHE:
+    case RenderFeature::TEMPORAL_REPROJECTION:
+    case RenderFeature::PREVIEW_INTEGRATORS:
+    case RenderFeature::VARIABLE_SAMPLE_DENSITY:
+    case RenderFeature::CHECKPOINT:
+        return true;
+    default:
+        return false;
+    }
+}
+
 void RenderEmbree::initialize(const int fb_width, const int fb_height)
 {
     frame_id = 0;
     fb_dims = glm::ivec2(fb_width, fb_height);
     img.resize(fb_width * fb_height);
+    dirty_regions.clear();
+    full_image_dirty = true;
 
     const glm::uvec2 ntiles(fb_dims.x / tile_size.x + (fb_dims.x % tile_size.x != 0 ? 1 : 0),
                             fb_dims.y / tile_size.y + (fb_dims.y % tile_size.y != 0 ? 1 : 0));
-    tiles.resize(ntiles.x * ntiles.y);
-    ray_stats.resize(tiles.size());
-    for (size_t i = 0; i < tiles.size(); ++i) {
-        tiles[i].resize(tile_size.x * tile_size.y * 3, 0.f);
-        ray_stats[i].resize(tile_size.x * tile_size.y, 0);
+    size_t pixel_bytes = 3 * sizeof(float);
+    if (accumulation_format == AccumulationFormat::FP16) {
+        pixel_bytes = 3 * sizeof(uint16_t);
+    } else if (accumulation_format == AccumulationFormat::RGB9E5) {
+        pixel_bytes = sizeof(uint32_t);
+    }
+    auto align_view = [](const size_t size) {
+        const size_t align = embree::TileArena::VIEW_ALIGNMENT;
+        return ((size + align - 1) / align) * align;
+    };
+    num_tiles = ntiles.x * ntiles.y;
+    tile_stride = align_view(tile_size.x * tile_size.y * pixel_bytes);
+    history_offset = tile_stride;
+    if (tracks_pixel_history()) {
+        tile_stride += align_view(tile_size.x * tile_size.y * sizeof(embree::PixelHistory));
+    }
+    size_t arena_size = num_tiles * tile_stride;
+#ifdef REPORT_RAY_STATS
+    ray_stats_stride = align_view(tile_size.x * tile_size.y * sizeof(uint16_t));
+    arena_size += num_tiles * ray_stats_stride;
+#endif
+    tile_arena.reserve(arena_size);
+
+    last_view_complete = false;
+    history_valid = false;
+    if (temporal_reprojection_frames > 0) {
+        history_color.resize(size_t(fb_dims.x) * fb_dims.y * 3);
+        history_pixels.resize(size_t(fb_dims.x) * fb_dims.y);
     }
 
+    primary_hits_valid = false;
+    if (primary_hit_cache_jitters > 0) {
+        primary_hit_stride = align_view(size_t(tile_size.x) * tile_size.y *
+                                        primary_hit_cache_jitters * ispc::primary_hit_size());
+        primary_hit_arena.reserve(num_tiles * primary_hit_stride);
+    }
+
+    tile_order.resize(num_tiles);
+    std::iota(tile_order.begin(), tile_order.end(), 0);
+    const glm::vec2 fb_center = glm::vec2(fb_dims) * 0.5f;
+    auto tile_center_dist = [&](const uint32_t tile_id) {
+        const glm::uvec2 tile = glm::uvec2(tile_id % ntiles.x, tile_id / ntiles.x);
+        const glm::vec2 center = glm::vec2(tile * tile_size) + glm::vec2(tile_size) * 0.5f;
+        return glm::length(center - fb_center);
+    };
+    std::stable_sort(tile_order.begin(), tile_order.end(), [&](uint32_t a, uint32_t b) {
+        return tile_center_dist(a) < tile_center_dist(b);
+    });
+
 #ifdef REPORT_RAY_STATS
-    num_rays.resize(tiles.size(), 0);
+    num_rays.resize(num_tiles, 0);
 #endif
 }
 
-void RenderEmbree::set_scene(const Scene &scene)
+// The channels of a scene texture sampled by the materials
+struct TextureChannelUsage {
+    // Set if the texture is used as a color and needs all its channels
+    bool all_channels = false;
+    // Bit mask of the stored channels sampled by scalar parameters
+    int channel_mask = 0;
+    // Number of channels in the packed texture, 0 if the texture isn't packed
+    int packed_channels = 0;
+    // Maps the stored channels to their channel in the packed texture
+    std::array<int, 4> channel_map = {0, 1, 2, 3};
+};
+
+static uint32_t float_as_uint(const float x)
 {
-    frame_id = 0;
+    uint32_t u;
+    std::memcpy(&u, &x, sizeof(float));
+    return u;
+}
 
-    samples_per_pixel = scene.samples_per_pixel;
+// Material channel selections refer to the RGBA channels the texture would expand to,
+// find the channel actually stored in the texture
+static int stored_texture_channel(const Image &tex, const int rgba_channel)
+{
+    if (tex.channels <= 2) {
+        return rgba_channel == 3 ? 1 : 0;
+    }
+    return rgba_channel;
+}
 
-    std::vector<std::shared_ptr<embree::TriangleMesh>> meshes;
-    for (const auto &mesh : scene.meshes) {
-        std::vector<std::shared_ptr<embree::Geometry>> geometries;
-        for (const auto &geom : mesh.geometries) {
-            geometries.push_back(std::make_shared<embree::Geometry>(
-                device, geom.vertices, geom.indices, geom.normals, geom.uvs));
+// Convert the scene texture to the linear, channel packed texture sampled by the backend
+static void convert_texture(const Image &src, const TextureChannelUsage &usage, Image &img)
+{
+    img.name = src.name;
+    img.width = src.width;
+    img.height = src.height;
+    img.channels = usage.packed_channels != 0 ? usage.packed_channels : src.channels;
+    img.color_space = LINEAR;
+    img.img.resize(size_t(img.width) * img.height * img.channels);
+
+    const int copy_mask =
+        usage.packed_channels != 0 ? usage.channel_mask : (1 << src.channels) - 1;
+    // Only the luminance or RGB channels are sRGB encoded, alpha is linear
+    const int srgb_channels = src.color_space == SRGB ? (src.channels <= 2 ? 1 : 3) : 0;
+    tbb::parallel_for(size_t(0), size_t(img.width) * img.height, [&](size_t px) {
+        for (int c = 0; c < src.channels; ++c) {
+            if (!(copy_mask & (1 << c))) {
+                continue;
+            }
+            uint8_t v = src.img[px * src.channels + c];
+            if (c < srgb_channels) {
+                const float x = srgb_to_linear(v / 255.f);
+                v = glm::clamp(x * 255.f, 0.f, 255.f);
+            }
+            img.img[px * img.channels + usage.channel_map[c]] = v;
         }
+    });
+}
 
-        meshes.push_back(std::make_shared<embree::TriangleMesh>(device, geometries));
-    }
+// Pointers to the material's scalar parameters which may be textured
+template <typename M>
+static auto scalar_params(M &m) -> std::array<decltype(&m.metallic), 11>
+{
+    return {&m.metallic,
+            &m.specular,
+            &m.roughness,
+            &m.specular_tint,
+            &m.anisotropy,
+            &m.sheen,
+            &m.sheen_tint,
+            &m.clearcoat,
+            &m.clearcoat_gloss,
+            &m.ior,
+            &m.specular_transmission};
+}
 
-    parameterized_meshes = scene.parameterized_meshes;
+void RenderEmbree::set_scene(const std::shared_ptr<const Scene> &in_scene)
+{
+    using namespace std::chrono;
+    frame_id = 0;
+    primary_hits_valid = false;
+    last_view_complete = false;
+    history_valid = false;
+    scene = in_scene;
+
+    samples_per_pixel = scene->samples_per_pixel;
+
+    // Find which channels of each texture the materials sample, textures which only have
+    // some of their channels used are packed down to just those channels
+    std::vector<TextureChannelUsage> texture_usage(scene->textures.size());
+    for (const auto &m : scene->materials) {
+        const uint32_t base_color = float_as_uint(m.base_color.x);
+        if (IS_TEXTURED_PARAM(base_color)) {
+            texture_usage[GET_TEXTURE_ID(base_color)].all_channels = true;
+        }
+        for (const float *param : scalar_params(m)) {
+            const uint32_t handle = float_as_uint(*param);
+            if (!IS_TEXTURED_PARAM(handle)) {
+                continue;
+            }
+            const uint32_t id = GET_TEXTURE_ID(handle);
+            const int channel =
+                stored_texture_channel(scene->textures[id], GET_TEXTURE_CHANNEL(handle));
+            if (channel < scene->textures[id].channels) {
+                texture_usage[id].channel_mask |= 1 << channel;
+            }
+        }
+    }
+    for (size_t i = 0; i < scene->textures.size(); ++i) {
+        auto &usage = texture_usage[i];
+        const int channels = scene->textures[i].channels;
+        if (usage.all_channels || usage.channel_mask == 0) {
+            continue;
+        }
+        int packed = 0;
+        for (int c = 0; c < channels; ++c) {
+            if (usage.channel_mask & (1 << c)) {
+                usage.channel_map[c] = packed++;
+            }
+        }
+        if (packed < channels) {
+            usage.packed_channels = packed;
+        } else {
+            usage.channel_map = {0, 1, 2, 3};
+        }
+    }
 
-    std::vector<std::shared_ptr<embree::Instance>> instances;
-    for (const auto &inst : scene.instances) {
-        const auto &pm = parameterized_meshes[inst.parameterized_mesh_id];
-        instances.push_back(std::make_shared<embree::Instance>(
-            device, meshes[pm.mesh_id], inst.transform, pm.material_ids));
+    // The textures are passed to ISPC as a flat array holding each texture's mip levels one
+    // after the other, the material texture IDs are remapped to the texture's first level
+    std::vector<uint32_t> texture_offsets(scene->textures.size(), 0);
+    uint32_t num_ispc_textures = 0;
+    for (size_t i = 0; i < scene->textures.size(); ++i) {
+        texture_offsets[i] = num_ispc_textures;
+        num_ispc_textures += texture_mipmaps ? mip_level_count(scene->textures[i].width,
+                                                               scene->textures[i].height)
+                                             : 1;
     }
 
-    scene_bvh = std::make_shared<embree::TopLevelBVH>(device, instances);
+    // The textures and materials don't depend on the BVHs, so convert them while the
+    // BVHs are being built
+    tbb::task_group conversion_tasks;
+    conversion_tasks.run([&]() {
+        // Linearize any sRGB textures beforehand, since we don't have fancy sRGB texture
+        // interpolation support in hardware, and pack down partially used textures.
+        // The mip chains are built from the converted textures, then all the levels are
+        // either block compressed or laid out in tiles. Textures which don't need
+        // converting are sampled from the scene in row-major order, rather than doubling
+        // their memory use with a tiled copy
+        converted_textures.clear();
+        converted_textures.resize(scene->textures.size());
+        texture_mips.clear();
+        texture_mips.resize(scene->textures.size());
+        tbb::parallel_for(size_t(0), scene->textures.size(), [&](size_t i) {
+            const Image &src = scene->textures[i];
+            const auto &usage = texture_usage[i];
+            const bool convert = src.color_space == SRGB || usage.packed_channels != 0;
+            auto &img = converted_textures[i];
+            if (convert) {
+                convert_texture(src, usage, img);
+            }
 
-    textures = scene.textures;
+            const Image &base = convert ? img : src;
+            auto &mips = texture_mips[i];
+            if (texture_mipmaps) {
+                mips = generate_mips(base);
+            }
+            // Textures only sampled by scalar parameters are kept uncompressed if they have
+            // more than two channels, as BC1's 565 endpoints are too coarse for them. With
+            // one or two channels they're compressed to BC4 or BC5, which encode each
+            // channel separately with 8-bit endpoints
+            const bool scalar_only = !usage.all_channels && usage.channel_mask != 0;
+            if (compress_textures && !(scalar_only && base.channels > 2)) {
+                // Each level is encoded a block row at a time, so a few large textures
+                // don't leave the other threads idle
+                std::vector<const Image *> levels = {&base};
+                for (const auto &m : mips) {
+                    levels.push_back(&m);
+                }
+                std::vector<Image> compressed(levels.size());
+                tbb::parallel_for(size_t(0), levels.size(), [&](size_t l) {
+                    compressed[l] = compressed_texture_layout(*levels[l]);
+                    tbb::parallel_for(0, texture_block_rows(*levels[l]), [&](int by) {
+                        compress_texture_blocks(*levels[l], compressed[l], by, by + 1);
+                    });
+                });
+                img = std::move(compressed[0]);
+                std::move(compressed.begin() + 1, compressed.end(), mips.begin());
+            } else {
+                if (convert) {
+                    embree::tile_texture(img);
+                }
+                for (auto &m : mips) {
+                    embree::tile_texture(m);
+                }
+            }
+        });
+        texture_bytes = 0;
+        for (size_t i = 0; i < scene->textures.size(); ++i) {
+            texture_bytes += converted_textures[i].img.size();
+            for (const auto &m : texture_mips[i]) {
+                texture_bytes += m.img.size();
+            }
+        }
 
-    // Linearize any sRGB textures beforehand, since we don't have fancy sRGB texture
-    // interpolation support in hardware
-    tbb::parallel_for(size_t(0), textures.size(), [&](size_t i) {
-        auto &img = textures[i];
-        if (img.color_space == LINEAR) {
-            return;
+        ispc_textures.clear();
+        ispc_textures.reserve(num_ispc_textures);
+        for (size_t i = 0; i < scene->textures.size(); ++i) {
+            const bool converted = !converted_textures[i].img.empty();
+            const Image &img = converted ? converted_textures[i] : scene->textures[i];
+            const auto &mips = texture_mips[i];
+            const bool tiled = img.format == TextureFormat::UNCOMPRESSED;
+            ispc_textures.push_back(
+                embree::ISPCTexture2D(img, mips.size() + 1, tiled && converted));
+            for (size_t l = 0; l < mips.size(); ++l) {
+                ispc_textures.push_back(
+                    embree::ISPCTexture2D(mips[l], mips.size() - l, tiled));
+            }
         }
-        img.color_space = LINEAR;
-        const int convert_channels = std::min(3, img.channels);
-        tbb::parallel_for(size_t(0), size_t(img.width) * img.height, [&](size_t px) {
-            for (int c = 0; c < convert_channels; ++c) {
-                float x = img.img[px * img.channels + c] / 255.f;
-                x = srgb_to_linear(x);
-                img.img[px * img.channels + c] = glm::clamp(x * 255.f, 0.f, 255.f);
+    });
+    conversion_tasks.run([&]() {
+        material_params.clear();
+        material_params.reserve(scene->materials.size());
+        for (const auto &m : scene->materials) {
+            embree::MaterialParams p;
+
+            p.base_color = m.base_color;
+            p.metallic = m.metallic;
+            p.specular = m.specular;
+            p.roughness = m.roughness;
+            p.specular_tint = m.specular_tint;
+            p.anisotropy = m.anisotropy;
+            p.sheen = m.sheen;
+            p.sheen_tint = m.sheen_tint;
+            p.clearcoat = m.clearcoat;
+            p.clearcoat_gloss = m.clearcoat_gloss;
+            p.ior = m.ior;
+            p.specular_transmission = m.specular_transmission;
+
+            // Point the texture handles at the texture's first mip level and the channel to
+            // sample in the stored or packed texture. Channels the texture doesn't have are
+            // mapped past its channel count, for which the sampler returns 1
+            for (float *param : scalar_params(p)) {
+                uint32_t handle = float_as_uint(*param);
+                if (!IS_TEXTURED_PARAM(handle)) {
+                    continue;
+                }
+                const uint32_t id = GET_TEXTURE_ID(handle);
+                const Image &tex = scene->textures[id];
+                const int channel = stored_texture_channel(tex, GET_TEXTURE_CHANNEL(handle));
+                const int mapped =
+                    channel < tex.channels ? texture_usage[id].channel_map[channel] : 3;
+                handle = TEXTURED_PARAM_MASK;
+                SET_TEXTURE_ID(handle, texture_offsets[id]);
+                SET_TEXTURE_CHANNEL(handle, mapped);
+                std::memcpy(param, &handle, sizeof(float));
             }
-        });
+            uint32_t base_color = float_as_uint(p.base_color.x);
+            if (IS_TEXTURED_PARAM(base_color)) {
+                const uint32_t id = GET_TEXTURE_ID(base_color);
+                base_color = TEXTURED_PARAM_MASK;
+                SET_TEXTURE_ID(base_color, texture_offsets[id]);
+                std::memcpy(&p.base_color.x, &base_color, sizeof(float));
+            }
+
+            material_params.push_back(p);
+        }
     });
 
-    ispc_textures.reserve(textures.size());
-    std::transform(textures.begin(),
-                   textures.end(),
-                   std::back_inserter(ispc_textures),
-                   [](const Image &img) { return embree::ISPCTexture2D(img); });
+    RTCBuildQuality build_quality = RTC_BUILD_QUALITY_MEDIUM;
+    if (bvh_quality == BVHQuality::LOW) {
+        build_quality = RTC_BUILD_QUALITY_LOW;
+    } else if (bvh_quality == BVHQuality::HIGH) {
+        build_quality = RTC_BUILD_QUALITY_HIGH;
+    }
+    int scene_flags = RTC_SCENE_FLAG_NONE;
+    if (bvh_compact) {
+        scene_flags |= RTC_SCENE_FLAG_COMPACT;
+    }
+    if (bvh_robust) {
+        scene_flags |= RTC_SCENE_FLAG_ROBUST;
+    }
+    const RTCSceneFlags build_flags = static_cast<RTCSceneFlags>(scene_flags);
 
-    material_params.reserve(scene.materials.size());
-    for (const auto &m : scene.materials) {
-        embree::MaterialParams p;
+    // The meshes are independent, so their BVHs are built in parallel. Embree builds
+    // within the TBB arena, so each commit can also spread across the idle threads
+    auto start = high_resolution_clock::now();
+    std::vector<std::shared_ptr<embree::TriangleMesh>> meshes(scene->meshes.size());
+    tbb::parallel_for(size_t(0), scene->meshes.size(), [&](size_t i) {
+        const auto &mesh = scene->meshes[i];
+        RTCBuildQuality mesh_quality = build_quality;
+        if (build_quality == RTC_BUILD_QUALITY_HIGH && bvh_high_quality_max_tris > 0 &&
+            mesh.num_tris() > bvh_high_quality_max_tris) {
+            mesh_quality = RTC_BUILD_QUALITY_MEDIUM;
+        }
 
-        p.base_color = m.base_color;
-        p.metallic = m.metallic;
-        p.specular = m.specular;
-        p.roughness = m.roughness;
-        p.specular_tint = m.specular_tint;
-        p.anisotropy = m.anisotropy;
-        p.sheen = m.sheen;
-        p.sheen_tint = m.sheen_tint;
-        p.clearcoat = m.clearcoat;
-        p.clearcoat_gloss = m.clearcoat_gloss;
-        p.ior = m.ior;
-        p.specular_transmission = m.specular_transmission;
+        std::vector<std::shared_ptr<embree::Geometry>> geometries(mesh.geometries.size());
+        tbb::parallel_for(size_t(0), mesh.geometries.size(), [&](size_t j) {
+            geometries[j] =
+                std::make_shared<embree::Geometry>(device, mesh.geometries[j], mesh_quality);
+        });
 
-        material_params.push_back(p);
-    }
+        meshes[i] = std::make_shared<embree::TriangleMesh>(
+            device, geometries, mesh_quality, build_flags);
+    });
+    auto end = high_resolution_clock::now();
+    const float blas_build_time = duration_cast<nanoseconds>(end - start).count() * 1.0e-6;
+
+    std::vector<std::shared_ptr<embree::Instance>> instances(scene->instances.size());
+    tbb::parallel_for(size_t(0), scene->instances.size(), [&](size_t i) {
+        const auto &inst = scene->instances[i];
+        const auto &pm = scene->parameterized_meshes[inst.parameterized_mesh_id];
+        instances[i] = std::make_shared<embree::Instance>(
+            device, meshes[pm.mesh_id], inst.transform, pm.material_ids);
+    });
 
-    lights = scene.lights;
+    start = high_resolution_clock::now();
+    scene_bvh =
+        std::make_shared<embree::TopLevelBVH>(device, instances, build_quality, build_flags);
+    end = high_resolution_clock::now();
+    const float tlas_build_time = duration_cast<nanoseconds>(end - start).count() * 1.0e-6;
+    std::cout << "Embree BLAS build time: " << blas_build_time << "ms (" << meshes.size()
+              << " meshes)\n"
+              << "Embree TLAS build time: " << tlas_build_time << "ms ("
+              << instances.size() << " instances)\n";
+
+    conversion_tasks.wait();
+
+    lights = scene->lights;
+
+    // Ambient occlusion looks for occluders within a tenth of the scene's size
+    RTCBounds bounds;
+    rtcGetSceneBounds(scene_bvh->handle, &bounds);
+    const glm::vec3 extent(bounds.upper_x - bounds.lower_x,
+                           bounds.upper_y - bounds.lower_y,
+                           bounds.upper_z - bounds.lower_z);
+    ao_distance = std::max(0.1f * glm::length(extent), 1e-4f);
 }
 
-RenderStats RenderEmbree::render(const glm::vec3 &pos,
-                                 const glm::vec3 &dir,
-                                 const glm::vec3 &up,
-                                 const float fovy,
-                                 const bool camera_changed,
-                                 const bool)
+embree::ViewParams RenderEmbree::make_view_params(const glm::vec3 &pos,
+                                                 const glm::vec3 &dir,
+                                                 const glm::vec3 &up,
+                                                 const float fovy,
+                                                 const glm::uvec2 &dims) const
 {
-    using namespace std::chrono;
-    RenderStats stats;
-
-    if (camera_changed) {
-        frame_id = 0;
-    }
-
     glm::vec2 img_plane_size;
     img_plane_size.y = 2.f * std::tan(glm::radians(0.5f * fovy));
-    img_plane_size.x = img_plane_size.y * static_cast<float>(fb_dims.x) / fb_dims.y;
+    img_plane_size.x = img_plane_size.y * static_cast<float>(dims.x) / dims.y;
 
     embree::ViewParams view_params;
     view_params.pos = pos;
@@ -156,8 +486,12 @@ RenderStats RenderEmbree::render(const glm::vec3 &pos,
     view_params.dir_dv =
         -glm::normalize(glm::cross(view_params.dir_du, dir)) * img_plane_size.y;
     view_params.dir_top_left = dir - 0.5f * view_params.dir_du - 0.5f * view_params.dir_dv;
-    view_params.frame_id = frame_id;
+    view_params.frame_id = 0;
+    return view_params;
+}
 
+embree::SceneContext RenderEmbree::make_scene_context()
+{
     embree::SceneContext ispc_scene;
     ispc_scene.scene = scene_bvh->handle;
     ispc_scene.instances = scene_bvh->ispc_instances.data();
@@ -166,16 +500,50 @@ RenderStats RenderEmbree::render(const glm::vec3 &pos,
     ispc_scene.lights = lights.data();
     ispc_scene.num_lights = lights.size();
     ispc_scene.samples_per_pixel = samples_per_pixel;
+    ispc_scene.ao_samples = std::max(ao_samples, uint32_t(1));
+    ispc_scene.ao_distance = ao_distance;
+    return ispc_scene;
+}
+
+RenderStats RenderEmbree::render(const glm::vec3 &pos,
+                                 const glm::vec3 &dir,
+                                 const glm::vec3 &up,
+                                 const float fovy,
+                                 const bool camera_changed,
+                                 const bool)
+{
+    using namespace std::chrono;
+    RenderStats stats;
+
+    // Switching integrators restarts accumulation. The reprojection history is only tracked
+    // by the path tracer, so when switching to a preview integrator the last path traced
+    // image is kept, to reproject into the view path tracing resumes with
+    const bool integrator_changed = integrator != accumulated_integrator;
+    accumulated_integrator = integrator;
+    const bool path_tracing = integrator == Integrator::PATH_TRACER;
+    const bool reprojecting = temporal_reprojection_frames > 0 && path_tracing &&
+                              (camera_changed || integrator_changed);
+    const bool keep_history = temporal_reprojection_frames > 0 && !path_tracing &&
+                              (camera_changed || integrator_changed);
+    if (camera_changed || integrator_changed) {
+        frame_id = 0;
+        primary_hits_valid = false;
+    }
+
+    embree::ViewParams view_params = make_view_params(pos, dir, up, fovy, fb_dims);
+    view_params.frame_id = frame_id;
+
+    embree::SceneContext ispc_scene = make_scene_context();
 
     // Round up the number of tiles we need to run in case the
     // framebuffer is not an even multiple of tile size
     const glm::uvec2 ntiles(fb_dims.x / tile_size.x + (fb_dims.x % tile_size.x != 0 ? 1 : 0),
                             fb_dims.y / tile_size.y + (fb_dims.y % tile_size.y != 0 ? 1 : 0));
 
-    uint8_t *color = reinterpret_cast<uint8_t *>(img.data());
+    const bool use_sample_density = variable_sample_density &&
+                                    sample_density.size() == size_t(fb_dims.x) * fb_dims.y;
 
-    auto start = high_resolution_clock::now();
-    tbb::parallel_for(uint32_t(0), ntiles.x * ntiles.y, [&](uint32_t tile_id) {
+    auto make_ispc_tile = [&](const uint32_t tile_id) {
         const glm::uvec2 tile = glm::uvec2(tile_id % ntiles.x, tile_id / ntiles.x);
         const glm::uvec2 tile_pos = tile * tile_size;
         const glm::uvec2 tile_end = glm::min(tile_pos + tile_size, fb_dims);
@@ -188,29 +556,416 @@ RenderStats RenderEmbree::render(const glm::vec3 &pos,
         ispc_tile.height = actual_tile_dims.y;
         ispc_tile.fb_width = fb_dims.x;
         ispc_tile.fb_height = fb_dims.y;
-        ispc_tile.data = tiles[tile_id].data();
-        ispc_tile.ray_stats = ray_stats[tile_id].data();
+        ispc_tile.accumulation_format = static_cast<uint32_t>(accumulation_format);
+        ispc_tile.data = tile_arena.get() + tile_id * tile_stride;
+#ifdef REPORT_RAY_STATS
+        ispc_tile.ray_stats = reinterpret_cast<uint16_t *>(
+            tile_arena.get() + num_tiles * tile_stride + tile_id * ray_stats_stride);
+#else
+        ispc_tile.ray_stats = nullptr;
+#endif
+        ispc_tile.primary_hits =
+            primary_hits_valid ? primary_hit_arena.get() + tile_id * primary_hit_stride
+                               : nullptr;
+        ispc_tile.primary_hit_jitters = primary_hit_cache_jitters;
+        ispc_tile.history = nullptr;
+        if (tracks_pixel_history()) {
+            ispc_tile.history = reinterpret_cast<embree::PixelHistory *>(
+                tile_arena.get() + tile_id * tile_stride + history_offset);
+        }
+        ispc_tile.reprojection = nullptr;
+        ispc_tile.sample_density = use_sample_density ? sample_density.data() : nullptr;
+        return ispc_tile;
+    };
+
+    // When the camera moves keep the image accumulated for the last completed view to
+    // reproject into the new one. If the view the tiles were accumulating was abandoned
+    // part way through, the image kept for the view before it is reprojected again
+    embree::Reprojection reprojection;
+    if ((reprojecting || keep_history) && last_view_complete) {
+        tbb::parallel_for(uint32_t(0), ntiles.x * ntiles.y, [&](uint32_t tile_id) {
+            embree::Tile ispc_tile = make_ispc_tile(tile_id);
+            ispc::tile_to_history(&ispc_tile, history_color.data(), history_pixels.data());
+        });
+        history_view = last_view;
+        history_valid = true;
+    }
+    if (reprojecting) {
+        reprojection.view = history_view;
+        reprojection.color = history_color.data();
+        reprojection.history = history_pixels.data();
+        reprojection.max_frames = temporal_reprojection_frames;
+    }
+    if (camera_changed || integrator_changed) {
+        last_view_complete = false;
+    }
 
-        ispc::trace_rays(&ispc_scene, &ispc_tile, &view_params);
+#ifdef REPORT_RAY_STATS
+    std::fill(num_rays.begin(), num_rays.end(), 0);
+#endif
 
-        ispc::tile_to_uint8(&ispc_tile, color);
+    // Each pass takes samples_per_pixel samples for every pixel and is accumulated as
+    // a frame. With a time budget we keep running passes while the estimated cost of the
+    // next one still fits in the budget, otherwise we run a single pass.
+    std::atomic<bool> cancelled(false);
+    uint32_t num_passes = 0;
+    float elapsed_time = 0.f;
+    float pass_time_estimate = 0.f;
+    auto start = high_resolution_clock::now();
+
+    // Once the camera has stopped moving, trace and shade the first hits for the frames
+    // which follow to start from
+    if (primary_hit_cache_jitters > 0 && integrator == Integrator::PATH_TRACER &&
+        !camera_changed && !primary_hits_valid) {
+        tbb::parallel_for(uint32_t(0), ntiles.x * ntiles.y, [&](uint32_t i) {
+            const uint32_t tile_id = tile_order[i];
+            if (cancelled.load(std::memory_order_relaxed) || frame_cancelled()) {
+                cancelled = true;
+                return;
+            }
+
+            embree::Tile ispc_tile = make_ispc_tile(tile_id);
+            ispc_tile.primary_hits = primary_hit_arena.get() + tile_id * primary_hit_stride;
+            ispc::cache_primary_hits(&ispc_scene, &ispc_tile, &view_params);
+        });
+        primary_hits_valid = !cancelled;
+    }
+
+    // With a sample density map the tiles are rendered densest first, so the region of
+    // interest is done first
+    if (use_sample_density) {
+        tile_density.resize(num_tiles);
+        tbb::parallel_for(uint32_t(0), ntiles.x * ntiles.y, [&](uint32_t tile_id) {
+            const embree::Tile ispc_tile = make_ispc_tile(tile_id);
+            float total = 0.f;
+            for (uint32_t y = 0; y < ispc_tile.height; ++y) {
+                const float *row = sample_density.data() + (ispc_tile.y + y) * fb_dims.x;
+                total = std::accumulate(
+                    row + ispc_tile.x, row + ispc_tile.x + ispc_tile.width, total);
+            }
+            tile_density[tile_id] = total / (ispc_tile.width * ispc_tile.height);
+        });
+        density_tile_order = tile_order;
+        std::stable_sort(
+            density_tile_order.begin(), density_tile_order.end(), [&](uint32_t a, uint32_t b) {
+                return tile_density[a] > tile_density[b];
+            });
+    }
+    const std::vector<uint32_t> &frame_tile_order =
+        use_sample_density ? density_tile_order : tile_order;
+
+    do {
+        view_params.frame_id = frame_id;
+        tbb::parallel_for(uint32_t(0), ntiles.x * ntiles.y, [&](uint32_t i) {
+            const uint32_t tile_id = frame_tile_order[i];
+            if (cancelled.load(std::memory_order_relaxed) || frame_cancelled()) {
+                cancelled = true;
+                return;
+            }
+
+            embree::Tile ispc_tile = make_ispc_tile(tile_id);
+            switch (integrator) {
+            case Integrator::ALBEDO:
+                ispc::trace_albedo(&ispc_scene, &ispc_tile, &view_params);
+                break;
+            case Integrator::AMBIENT_OCCLUSION:
+                ispc::trace_ambient_occlusion(&ispc_scene, &ispc_tile, &view_params);
+                break;
+            case Integrator::DIRECT_LIGHTING:
+                ispc::trace_direct_lighting(&ispc_scene, &ispc_tile, &view_params);
+                break;
+            default:
+                if (reprojecting && history_valid && num_passes == 0) {
+                    ispc_tile.reprojection = &reprojection;
+                }
+                ispc::trace_rays(&ispc_scene, &ispc_tile, &view_params);
+                break;
+            }
 #ifdef REPORT_RAY_STATS
-        num_rays[tile_id] = std::accumulate(
-            ray_stats[tile_id].begin(),
-            ray_stats[tile_id].end(),
-            uint64_t(0),
-            [](const uint64_t &total, const uint16_t &c) { return total + c; });
+            num_rays[tile_id] += std::accumulate(
+                ispc_tile.ray_stats,
+                ispc_tile.ray_stats + ispc_tile.width * ispc_tile.height,
+                uint64_t(0),
+                [](const uint64_t &total, const uint16_t &c) { return total + c; });
 #endif
+        });
+        if (cancelled) {
+            break;
+        }
+        ++frame_id;
+        ++num_passes;
+
+        const float pass_start_time = elapsed_time;
+        elapsed_time =
+            duration_cast<nanoseconds>(high_resolution_clock::now() - start).count() * 1.0e-6;
+        // Weight recent passes more heavily, as later passes can get cheaper or more
+        // expensive as the other threads on the machine come and go
+        const float pass_time = elapsed_time - pass_start_time;
+        pass_time_estimate =
+            num_passes == 1 ? pass_time : glm::mix(pass_time_estimate, pass_time, 0.5f);
+    } while (frame_time_budget > 0.f &&
+             elapsed_time + pass_time_estimate <= frame_time_budget);
+
+    // The accumulation buffer is only partially updated for a cancelled frame, so the
+    // next frame must start accumulating again from scratch
+    if (cancelled) {
+        auto end = high_resolution_clock::now();
+        stats.render_time = duration_cast<nanoseconds>(end - start).count() * 1.0e-6;
+        stats.cancelled = true;
+        frame_id = 0;
+        last_view_complete = false;
+        return stats;
+    }
+    last_view = view_params;
+    last_view_complete = integrator == Integrator::PATH_TRACER;
+
+    // Each tile is resolved into a scratch buffer and only copied into the image, and
+    // reported as dirty, if its displayed colors changed. Tiles which are close to
+    // converged often resolve to the same 8-bit colors as the previous frame
+    tbb::enumerable_thread_specific<std::vector<uint32_t>> resolve_buffers;
+    std::vector<uint8_t> tile_changed(ntiles.x * ntiles.y, 0);
+    tbb::parallel_for(uint32_t(0), ntiles.x * ntiles.y, [&](uint32_t tile_id) {
+        const embree::Tile ispc_tile = make_ispc_tile(tile_id);
+        std::vector<uint32_t> &resolved = resolve_buffers.local();
+        resolved.resize(size_t(ispc_tile.width) * ispc_tile.height);
+
+        embree::Tile resolve_tile = ispc_tile;
+        resolve_tile.x = 0;
+        resolve_tile.y = 0;
+        resolve_tile.fb_width = ispc_tile.width;
+        resolve_tile.fb_height = ispc_tile.height;
+        ispc::tile_to_uint8(&resolve_tile, reinterpret_cast<uint8_t *>(resolved.data()));
+
+        for (uint32_t y = 0; y < ispc_tile.height; ++y) {
+            const uint32_t *src = resolved.data() + y * ispc_tile.width;
+            uint32_t *dst = img.data() + (ispc_tile.y + y) * fb_dims.x + ispc_tile.x;
+            if (!std::equal(src, src + ispc_tile.width, dst)) {
+                std::copy(src, src + ispc_tile.width, dst);
+                tile_changed[tile_id] = 1;
+            }
+        }
     });
+    dirty_regions.clear();
+    for (uint32_t tile_id = 0; tile_id < ntiles.x * ntiles.y; ++tile_id) {
+        if (tile_changed[tile_id]) {
+            const embree::Tile ispc_tile = make_ispc_tile(tile_id);
+            dirty_regions.push_back(
+                glm::uvec4(ispc_tile.x, ispc_tile.y, ispc_tile.width, ispc_tile.height));
+        }
+    }
+    full_image_dirty = false;
     auto end = high_resolution_clock::now();
     stats.render_time = duration_cast<nanoseconds>(end - start).count() * 1.0e-6;
+    stats.samples_per_pixel = num_passes * samples_per_pixel;
 
 #ifdef REPORT_RAY_STATS
     const uint64_t total_rays = std::accumulate(num_rays.begin(), num_rays.end(), 0);
     stats.rays_per_second = total_rays / (stats.render_time * 1.0e-3);
 #endif
 
-    ++frame_id;
-
     return stats;
 }
+
+size_t RenderEmbree::texture_memory()
+{
+    return texture_bytes;
+}
+
+bool RenderEmbree::render_poster(TiledImageFile &file,
+                                 const glm::vec3 &pos,
+                                 const glm::vec3 &dir,
+                                 const glm::vec3 &up,
+                                 const float fovy,
+                                 const uint32_t passes)
+{
+    using namespace std::chrono;
+    const glm::uvec2 dims = file.dimensions();
+    const glm::uvec2 poster_tile_size = file.tile_dimensions();
+    const glm::uvec2 ntiles = file.tile_count();
+
+    const embree::ViewParams view_params = make_view_params(pos, dir, up, fovy, dims);
+    embree::SceneContext ispc_scene = make_scene_context();
+
+    // Only the tiles being rendered by each thread are kept in memory
+    tbb::enumerable_thread_specific<OfflineTile> poster_tiles;
+
+    const size_t tiles_remaining = file.tiles_remaining();
+    std::atomic<size_t> tiles_done(0);
+    std::mutex progress_mutex;
+    auto start = high_resolution_clock::now();
+    tbb::parallel_for(size_t(0), file.num_tiles(), [&](size_t tile_id) {
+        if (file.is_tile_done(tile_id)) {
+            return;
+        }
+        OfflineTile &buffers = poster_tiles.local();
+        buffers.color.resize(size_t(poster_tile_size.x) * poster_tile_size.y);
+
+        const glm::uvec2 tile = glm::uvec2(tile_id % ntiles.x, tile_id / ntiles.x);
+        const glm::uvec2 tile_pos = tile * poster_tile_size;
+        const glm::uvec2 tile_end = glm::min(tile_pos + poster_tile_size, dims);
+        const embree::Tile ispc_tile = trace_offline_tile(
+            ispc_scene, view_params, dims, tile_pos, tile_end, passes, buffers);
+
+        // Resolve the tile into its own buffer rather than a framebuffer for the image
+        embree::Tile resolve_tile = ispc_tile;
+        resolve_tile.x = 0;
+        resolve_tile.y = 0;
+        resolve_tile.fb_width = poster_tile_size.x;
+        resolve_tile.fb_height = poster_tile_size.y;
+        ispc::tile_to_uint8(&resolve_tile, reinterpret_cast<uint8_t *>(buffers.color.data()));
+        file.write_tile(tile_id, buffers.color.data());
+
+        const size_t done = ++tiles_done;
+        if ((done * 100) / tiles_remaining != ((done - 1) * 100) / tiles_remaining) {
+            const float elapsed =
+                duration_cast<milliseconds>(high_resolution_clock::now() - start).count() *
+                1.0e-3f;
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            std::cout << "Poster: " << done << "/" << tiles_remaining << " tiles ("
+                      << (done * 100) / tiles_remaining << "%) in " << elapsed << "s\n";
+        }
+    });
+    return true;
+}
+
+bool RenderEmbree::render_batch(const std::vector<Camera> &cameras,
+                                const glm::uvec2 &dims,
+                                const uint32_t passes,
+                                const BatchViewCallback &view_done)
+{
+    using namespace std::chrono;
+    const glm::uvec2 ntiles(dims.x / tile_size.x + (dims.x % tile_size.x != 0 ? 1 : 0),
+                            dims.y / tile_size.y + (dims.y % tile_size.y != 0 ? 1 : 0));
+    const size_t tiles_per_view = size_t(ntiles.x) * ntiles.y;
+
+    std::vector<embree::ViewParams> views;
+    for (const auto &c : cameras) {
+        const glm::vec3 dir = glm::normalize(c.center - c.position);
+        views.push_back(make_view_params(c.position, dir, c.up, c.fov_y, dims));
+    }
+    embree::SceneContext ispc_scene = make_scene_context();
+
+    // Each view's image is allocated by its first tile and freed once it's been handed to
+    // view_done, so only the views in flight are held in memory
+    std::vector<std::vector<uint32_t>> images(cameras.size());
+    std::vector<std::once_flag> image_allocated(cameras.size());
+    std::vector<std::atomic<size_t>> tiles_remaining(cameras.size());
+    std::vector<std::atomic<uint64_t>> view_time_us(cameras.size());
+    for (size_t i = 0; i < cameras.size(); ++i) {
+        tiles_remaining[i] = tiles_per_view;
+        view_time_us[i] = 0;
+    }
+
+    // The views' tiles are handed out in order from a shared counter, so threads move on
+    // to the next view's tiles instead of idling while the last tiles of a view finish,
+    // while only the views at the front of the batch are in flight. The time reported for
+    // each view is the thread time spent on its tiles
+    const size_t total_tiles = cameras.size() * tiles_per_view;
+    std::atomic<size_t> next_tile(0);
+    tbb::enumerable_thread_specific<OfflineTile> batch_tiles;
+    auto render_tile = [&](const size_t i) {
+        const size_t view_id = i / tiles_per_view;
+        const size_t tile_id = i % tiles_per_view;
+        auto start = high_resolution_clock::now();
+
+        std::call_once(image_allocated[view_id],
+                       [&]() { images[view_id].resize(size_t(dims.x) * dims.y); });
+
+        const glm::uvec2 tile = glm::uvec2(tile_id % ntiles.x, tile_id / ntiles.x);
+        const glm::uvec2 tile_pos = tile * tile_size;
+        const glm::uvec2 tile_end = glm::min(tile_pos + tile_size, dims);
+        embree::Tile ispc_tile = trace_offline_tile(ispc_scene,
+                                                    views[view_id],
+                                                    dims,
+                                                    tile_pos,
+                                                    tile_end,
+                                                    passes,
+                                                    batch_tiles.local());
+        ispc::tile_to_uint8(&ispc_tile, reinterpret_cast<uint8_t *>(images[view_id].data()));
+
+        view_time_us[view_id] +=
+            duration_cast<microseconds>(high_resolution_clock::now() - start).count();
+        if (--tiles_remaining[view_id] == 0) {
+            view_done(view_id, images[view_id].data(), view_time_us[view_id] * 1.0e-3f);
+            std::vector<uint32_t>().swap(images[view_id]);
+        }
+    };
+    const int num_workers = tbb::this_task_arena::max_concurrency();
+    tbb::parallel_for(0, num_workers, [&](int) {
+        for (size_t i = next_tile++; i < total_tiles; i = next_tile++) {
+            render_tile(i);
+        }
+    });
+    return true;
+}
+
+bool RenderEmbree::save_accumulation(AccumulationState &state)
+{
+    // Only the tiles and their pixel history are saved, the ray stats are recomputed each
+    // frame
+    const uint8_t *accum = tile_arena.get();
+    state.fb_dims = fb_dims;
+    state.accumulation_format = static_cast<uint32_t>(accumulation_format);
+    state.frame_id = frame_id;
+    state.data.assign(accum, accum + num_tiles * tile_stride);
+    return true;
+}
+
+bool RenderEmbree::restore_accumulation(const AccumulationState &state)
+{
+    if (state.fb_dims != fb_dims ||
+        state.accumulation_format != static_cast<uint32_t>(accumulation_format) ||
+        state.data.size() != num_tiles * tile_stride) {
+        return false;
+    }
+    std::memcpy(tile_arena.get(), state.data.data(), state.data.size());
+    // The RNG is seeded from the frame id, so the next frame picks up the sample sequence
+    // where the saved render left off
+    frame_id = state.frame_id;
+    return true;
+}
+
+embree::Tile RenderEmbree::trace_offline_tile(embree::SceneContext &ispc_scene,
+                                              const embree::ViewParams &view_params,
+                                              const glm::uvec2 &dims,
+                                              const glm::uvec2 &tile_pos,
+                                              const glm::uvec2 &tile_end,
+                                              const uint32_t passes,
+                                              OfflineTile &buffers)
+{
+    embree::Tile ispc_tile;
+    ispc_tile.x = tile_pos.x;
+    ispc_tile.y = tile_pos.y;
+    ispc_tile.width = tile_end.x - tile_pos.x;
+    ispc_tile.height = tile_end.y - tile_pos.y;
+    ispc_tile.fb_width = dims.x;
+    ispc_tile.fb_height = dims.y;
+    ispc_tile.accumulation_format = static_cast<uint32_t>(AccumulationFormat::FP32);
+
+    const size_t tile_pixels = size_t(ispc_tile.width) * ispc_tile.height;
+    buffers.accum.resize(tile_pixels * 3);
+    ispc_tile.data = buffers.accum.data();
+#ifdef REPORT_RAY_STATS
+    buffers.ray_stats.resize(tile_pixels);
+    ispc_tile.ray_stats = buffers.ray_stats.data();
+#else
+    ispc_tile.ray_stats = nullptr;
+#endif
+    ispc_tile.primary_hits = nullptr;
+    ispc_tile.primary_hit_jitters = 0;
+    ispc_tile.history = nullptr;
+    ispc_tile.reprojection = nullptr;
+    ispc_tile.sample_density = nullptr;
+
+    embree::ViewParams tile_view_params = view_params;
+    for (uint32_t i = 0; i < passes; ++i) {
+        tile_view_params.frame_id = i;
+        ispc::trace_rays(&ispc_scene, &ispc_tile, &tile_view_params);
+    }
+    return ispc_tile;
+}
+
+bool RenderEmbree::tracks_pixel_history() const
+{
+    return temporal_reprojection_frames > 0 || variable_sample_density;
+}
@@ -12,33 +12,116 @@ struct RenderEmbree : RenderBackend {
     RTCDevice device;
     glm::uvec2 fb_dims;
 
-    // TODO: should take scene as shared ptr and keep ref to it,
-    std::vector<ParameterizedMesh> parameterized_meshes;
+    // The geometry and linear textures are used directly from the scene
+    std::shared_ptr<const Scene> scene;
     std::shared_ptr<embree::TopLevelBVH> scene_bvh;
 
     std::vector<embree::MaterialParams> material_params;
     std::vector<QuadLight> lights;
-    std::vector<Image> textures;
+    // The scene's textures converted for sampling: linearized, channel packed and either
+    // laid out in tiles or block compressed. Empty for textures sampled directly from the
+    // scene, which keep its row-major layout
+    std::vector<Image> converted_textures;
+    // Mip levels below the base level of each texture, if mipmapping is enabled
+    std::vector<std::vector<Image>> texture_mips;
     std::vector<embree::ISPCTexture2D> ispc_textures;
+    // Bytes held by the converted textures and mip levels
+    size_t texture_bytes = 0;
+    // The distance ambient occlusion rays look for occluders within, scaled to the scene
+    float ao_distance = 1.f;
 
     uint32_t frame_id = 0;
+    // The integrator the accumulated image was rendered with
+    Integrator accumulated_integrator = Integrator::PATH_TRACER;
     glm::uvec2 tile_size = glm::uvec2(64);
-    std::vector<std::vector<float>> tiles;
-    std::vector<std::vector<uint16_t>> ray_stats;
+    // Tiles are rendered starting from the center of the image and moving outwards, so the
+    // region that's most likely being looked at is done first
+    std::vector<uint32_t> tile_order;
+    // With a sample density map the densest tiles are rendered first instead
+    std::vector<uint32_t> density_tile_order;
+    std::vector<float> tile_density;
+    // The accumulated image for each tile, in the accumulation format, along with its
+    // pixel history if reprojecting, followed by the ray stats for each tile if they're
+    // reported. Each tile's buffers start at a multiple of the stride
+    embree::TileArena tile_arena;
+    size_t num_tiles = 0;
+    size_t tile_stride = 0;
 #ifdef REPORT_RAY_STATS
+    size_t ray_stats_stride = 0;
     std::vector<uint64_t> num_rays;
 #endif
+    // The first hits cached for each tile's pixels while the camera is still, if enabled.
+    // The cache is rebuilt by the first frame after the camera stops moving
+    embree::TileArena primary_hit_arena;
+    size_t primary_hit_stride = 0;
+    bool primary_hits_valid = false;
+    // With temporal reprojection each tile's pixel history follows its accumulated image
+    // within the tile's stride. When the camera moves the image for the last completed view
+    // is copied out of the tiles, to reproject into the new view
+    size_t history_offset = 0;
+    embree::ViewParams last_view;
+    bool last_view_complete = false;
+    embree::ViewParams history_view;
+    std::vector<float> history_color;
+    std::vector<embree::PixelHistory> history_pixels;
+    bool history_valid = false;
 
     RenderEmbree();
     ~RenderEmbree();
 
     std::string name() override;
+    bool supports_render_thread() override;
+    bool supports_feature(const RenderFeature feature) override;
     void initialize(const int fb_width, const int fb_height) override;
-    void set_scene(const Scene &scene) override;
+    void set_scene(const std::shared_ptr<const Scene> &scene) override;
     RenderStats render(const glm::vec3 &pos,
                        const glm::vec3 &dir,
                        const glm::vec3 &up,
                        const float fovy,
                        const bool camera_changed,
                        const bool readback_framebuffer) override;
+    size_t texture_memory() override;
+    bool render_poster(TiledImageFile &file,
+                       const glm::vec3 &pos,
+                       const glm::vec3 &dir,
+                       const glm::vec3 &up,
+                       const float fovy,
+                       const uint32_t passes) override;
+    bool render_batch(const std::vector<Camera> &cameras,
+                      const glm::uvec2 &dims,
+                      const uint32_t passes,
+                      const BatchViewCallback &view_done) override;
+    bool save_accumulation(AccumulationState &state) override;
+    bool restore_accumulation(const AccumulationState &state) override;
+
+private:
+    // Per-thread buffers for rendering offline tiles, which are accumulated on their own
+    // rather than in the tile arena
+    struct OfflineTile {
+        std::vector<float> accum;
+        std::vector<uint32_t> color;
+        std::vector<uint16_t> ray_stats;
+    };
+
+    embree::ViewParams make_view_params(const glm::vec3 &pos,
+                                        const glm::vec3 &dir,
+                                        const glm::vec3 &up,
+                                        const float fovy,
+                                        const glm::uvec2 &dims) const;
+
+    embree::SceneContext make_scene_context();
+
+    // Take all the passes for the tile of an offline image in one go, accumulating into the
+    // buffers. Returns the tile to resolve the image from
+    embree::Tile trace_offline_tile(embree::SceneContext &ispc_scene,
+                                    const embree::ViewParams &view_params,
+                                    const glm::uvec2 &dims,
+                                    const glm::uvec2 &tile_pos,
+                                    const glm::uvec2 &tile_end,
+                                    const uint32_t passes,
+                                    OfflineTile &buffers);
+
+    // The pixel history is tracked for reprojection and for weighting frames with a varying
+    // number of samples per-pixel
+    bool tracks_pixel_history() const;
 };
@@ -9,27 +9,22 @@ namespace embree {
 
 Geometry::Geometry(RTCDevice &device,
                    sycl::queue &sycl_queue,
-                   const std::vector<glm::vec3> &verts,
-                   const std::vector<glm::uvec3> &indices,
-                   const std::vector<glm::vec3> &normals,
-                   const std::vector<glm::vec2> &uvs)
-    : n_vertices(verts.size()),
-      vertex_buf(verts.begin(),
-                 verts.end(),
+                   const ::Geometry &mesh_geom)
+    : n_vertices(mesh_geom.num_vertices()),
+      vertex_buf(mesh_geom.vertices.begin(),
+                 mesh_geom.vertices.end(),
                  make_usm_device_read_only_allocator<glm::vec3>(sycl_queue)),
-      index_buf(indices.begin(),
-                indices.end(),
+      index_buf(mesh_geom.indices.begin(),
+                mesh_geom.indices.end(),
                 make_usm_device_read_only_allocator<glm::uvec3>(sycl_queue)),
-      normal_buf(normals.begin(),
-                 normals.end(),
+      normal_buf(mesh_geom.normals.begin(),
+                 mesh_geom.normals.end(),
                  make_usm_device_read_only_allocator<glm::vec3>(sycl_queue)),
-      uv_buf(
-          uvs.begin(), uvs.end(), make_usm_device_read_only_allocator<glm::vec2>(sycl_queue)),
+      uv_buf(mesh_geom.uvs.begin(),
+             mesh_geom.uvs.end(),
+             make_usm_device_read_only_allocator<glm::vec2>(sycl_queue)),
       geom(rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE))
 {
-    // Pad the vertex_buf out to align it
-    vertex_buf.push_back(glm::vec3(0.f));
-
     rtcSetSharedGeometryBuffer(geom,
                                RTC_BUFFER_TYPE_VERTEX,
                                0,
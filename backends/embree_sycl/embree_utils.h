@@ -7,6 +7,7 @@
 #include <vector>
 #include <embree4/rtcore.h>
 #include "../../util/lights.h"
+#include "../../util/mesh.h"
 #include "material.h"
 #include <glm/glm.hpp>
 
@@ -28,8 +29,8 @@ using usm_host_allocator = sycl::usm_allocator<T, sycl::usm::alloc::host>;
 namespace embree {
 
 struct Geometry {
-    // vertex_buf is padded out by an extra vec3 to meet Embree's alignment requirements,
-    // n_vertices is the real # of vertices, i.e. vertex_buf.size() - 1
+    // vertex_buf keeps the scene geometry's padding vertex to meet Embree's alignment
+    // requirements, n_vertices is the real # of vertices, i.e. vertex_buf.size() - 1
     size_t n_vertices = 0;
     std::vector<glm::vec3, usm_shared_allocator<glm::vec3>> vertex_buf;
     std::vector<glm::uvec3, usm_shared_allocator<glm::uvec3>> index_buf;
@@ -42,10 +43,7 @@ struct Geometry {
 
     Geometry(RTCDevice &device,
              sycl::queue &sycl_queue,
-             const std::vector<glm::vec3> &verts,
-             const std::vector<glm::uvec3> &indices,
-             const std::vector<glm::vec3> &normals,
-             const std::vector<glm::vec2> &uvs);
+             const ::Geometry &mesh_geom);
 
     ~Geometry();
 
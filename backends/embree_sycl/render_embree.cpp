@@ -64,8 +64,9 @@ void RenderEmbree::initialize(const int fb_width, const int fb_height)
 #endif
 }
 
-void RenderEmbree::set_scene(const Scene &scene)
+void RenderEmbree::set_scene(const std::shared_ptr<const Scene> &in_scene)
 {
+    const Scene &scene = *in_scene;
     frame_id = 0;
     samples_per_pixel = scene.samples_per_pixel;
 
@@ -73,8 +74,7 @@ void RenderEmbree::set_scene(const Scene &scene)
     for (const auto &mesh : scene.meshes) {
         std::vector<std::shared_ptr<embree::Geometry>> geometries;
         for (const auto &geom : mesh.geometries) {
-            geometries.push_back(std::make_shared<embree::Geometry>(
-                device, sycl_queue, geom.vertices, geom.indices, geom.normals, geom.uvs));
+            geometries.push_back(std::make_shared<embree::Geometry>(device, sycl_queue, geom));
         }
 
         meshes.push_back(
@@ -104,7 +104,8 @@ void RenderEmbree::set_scene(const Scene &scene)
             return;
         }
         img.color_space = LINEAR;
-        const int convert_channels = std::min(3, img.channels);
+        // Only the luminance or RGB channels are sRGB encoded, alpha is linear
+        const int convert_channels = img.channels <= 2 ? 1 : 3;
         tbb::parallel_for(size_t(0), size_t(img.width) * img.height, [&](size_t px) {
             for (int c = 0; c < convert_channels; ++c) {
                 float x = img.img[px * img.channels + c] / 255.f;
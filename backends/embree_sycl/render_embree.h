@@ -19,7 +19,6 @@ struct RenderEmbree : RenderBackend {
     RTCDevice device;
     glm::uvec2 fb_dims;
 
-    // TODO: should take scene as shared ptr and keep ref to it,
     std::vector<ParameterizedMesh> parameterized_meshes;
 
     std::shared_ptr<embree::TopLevelBVH> scene_bvh;
@@ -52,7 +51,7 @@ struct RenderEmbree : RenderBackend {
 
     std::string name() override;
     void initialize(const int fb_width, const int fb_height) override;
-    void set_scene(const Scene &scene) override;
+    void set_scene(const std::shared_ptr<const Scene> &scene) override;
     RenderStats render(const glm::vec3 &pos,
                        const glm::vec3 &dir,
                        const glm::vec3 &up,
@@ -5,18 +5,26 @@
 
 namespace kernel {
 
+// Textures are stored with their native channel count, single and two channel textures
+// are luminance and luminance + alpha. Textures without an alpha channel are opaque
 inline float4 get_texel(const embree::ISPCTexture2D *tex, const int2 px)
 {
+    const uint8_t *texel = &tex->data[((px.y * tex->width) + px.x) * tex->channels];
     float4 color = make_float4(0.f);
-    color.x = tex->data[((px.y * tex->width) + px.x) * tex->channels] / 255.f;
-    if (tex->channels >= 2) {
-        color.y = tex->data[((px.y * tex->width) + px.x) * tex->channels + 1] / 255.f;
-    }
-    if (tex->channels >= 3) {
-        color.z = tex->data[((px.y * tex->width) + px.x) * tex->channels + 2] / 255.f;
+    color.x = texel[0] / 255.f;
+    color.w = 1.f;
+    if (tex->channels <= 2) {
+        color.y = color.x;
+        color.z = color.x;
+        if (tex->channels == 2) {
+            color.w = texel[1] / 255.f;
+        }
+        return color;
     }
+    color.y = texel[1] / 255.f;
+    color.z = texel[2] / 255.f;
     if (tex->channels == 4) {
-        color.w = tex->data[((px.y * tex->width) + px.x) * tex->channels + 3] / 255.f;
+        color.w = texel[3] / 255.f;
     }
     return color;
 }
@@ -67,8 +75,17 @@ float4 texture(const embree::ISPCTexture2D *tex, const float2 uv)
            s11 * tx * ty;
 }
 
-float texture_channel(const embree::ISPCTexture2D *tex, const float2 uv, const int channel)
+float texture_channel(const embree::ISPCTexture2D *tex, const float2 uv, int channel)
 {
+    // The material selects an RGBA channel, which for luminance textures maps to the
+    // luminance or alpha channel. Textures without an alpha channel are opaque
+    if (tex->channels <= 2) {
+        channel = channel == 3 ? 1 : 0;
+    }
+    if (channel >= tex->channels) {
+        return 1.f;
+    }
+
     const float ux = uv.x * tex->width - 0.5f;
     const float uy = uv.y * tex->height - 0.5f;
 
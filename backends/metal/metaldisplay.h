@@ -37,6 +37,8 @@ struct MetalDisplay : Display {
 
     void display(RenderBackend *renderer) override;
 
+    bool needs_readback(RenderBackend *renderer) override;
+
     void display_native(const std::shared_ptr<metal::Texture2D> &img);
 };
 
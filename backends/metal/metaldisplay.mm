@@ -101,6 +101,11 @@ void MetalDisplay::display(RenderBackend *renderer)
     }
 }
 
+bool MetalDisplay::needs_readback(RenderBackend *renderer)
+{
+    return dynamic_cast<RenderMetal *>(renderer) == nullptr;
+}
+
 void MetalDisplay::display_native(const std::shared_ptr<metal::Texture2D> &img)
 {
     @autoreleasepool {
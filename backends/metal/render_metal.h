@@ -56,7 +56,7 @@ struct RenderMetal : RenderBackend {
 
     void initialize(const int fb_width, const int fb_height) override;
 
-    void set_scene(const Scene &scene) override;
+    void set_scene(const std::shared_ptr<const Scene> &scene) override;
 
     // Returns the rays per-second achieved, or -1 if this is not tracked
     RenderStats render(const glm::vec3 &pos,
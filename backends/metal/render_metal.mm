@@ -62,8 +62,9 @@ void RenderMetal::initialize(const int fb_width, const int fb_height)
     }
 }
 
-void RenderMetal::set_scene(const Scene &scene)
+void RenderMetal::set_scene(const std::shared_ptr<const Scene> &in_scene)
 {
+    const Scene &scene = *in_scene;
     frame_id = 0;
 
     samples_per_pixel = scene.samples_per_pixel;
@@ -295,7 +296,7 @@ void RenderMetal::allocate_heap(const Scene &scene)
 
             for (const auto &g : m.geometries) {
                 heap_builder
-                    .add_buffer(sizeof(glm::vec3) * g.vertices.size(),
+                    .add_buffer(sizeof(glm::vec3) * g.num_vertices(),
                                 MTLResourceStorageModePrivate)
                     .add_buffer(sizeof(glm::uvec3) * g.indices.size(),
                                 MTLResourceStorageModePrivate);
@@ -369,7 +370,7 @@ std::vector<std::shared_ptr<metal::BottomLevelBVH>> RenderMetal::build_meshes(
             std::vector<metal::Geometry> geometries;
             for (const auto &g : m.geometries) {
                 metal::Buffer vertex_upload(*context,
-                                            sizeof(glm::vec3) * g.vertices.size(),
+                                            sizeof(glm::vec3) * g.num_vertices(),
                                             MTLResourceStorageModeManaged);
 
                 std::memcpy(vertex_upload.data(), g.vertices.data(), vertex_upload.size());
@@ -533,6 +534,7 @@ std::vector<std::shared_ptr<metal::BottomLevelBVH>> RenderMetal::build_meshes(
 void RenderMetal::upload_textures(const std::vector<Image> &scene_textures)
 {
     @autoreleasepool {
+        std::vector<uint8_t> rgba_scratch;
         for (const auto &t : scene_textures) {
             const MTLPixelFormat format = t.color_space == LINEAR
                                               ? MTLPixelFormatRGBA8Unorm
@@ -540,7 +542,7 @@ void RenderMetal::upload_textures(const std::vector<Image> &scene_textures)
 
             metal::Texture2D upload(
                 *context, t.width, t.height, format, MTLTextureUsageShaderRead);
-            upload.upload(t.img.data());
+            upload.upload(rgba8_pixels(t, rgba_scratch));
 
             // Allocate a texture from the heap and copy into it
             auto heap_tex = std::make_shared<metal::Texture2D>(
@@ -121,8 +121,9 @@ void RenderOptiX::initialize(const int fb_width, const int fb_height)
     }
 }
 
-void RenderOptiX::set_scene(const Scene &scene)
+void RenderOptiX::set_scene(const std::shared_ptr<const Scene> &in_scene)
 {
+    const Scene &scene = *in_scene;
     frame_id = 0;
     samples_per_pixel = scene.samples_per_pixel;
 
@@ -135,8 +136,8 @@ void RenderOptiX::set_scene(const Scene &scene)
         std::vector<optix::Geometry> geometries;
         for (const auto &geom : mesh.geometries) {
             auto vertices =
-                std::make_shared<optix::Buffer>(geom.vertices.size() * sizeof(glm::vec3));
-            vertices->upload(geom.vertices);
+                std::make_shared<optix::Buffer>(geom.num_vertices() * sizeof(glm::vec3));
+            vertices->upload(geom.vertices.data(), vertices->size());
 
             auto indices =
                 std::make_shared<optix::Buffer>(geom.indices.size() * sizeof(glm::uvec3));
@@ -229,9 +230,10 @@ void RenderOptiX::set_scene(const Scene &scene)
     const cudaChannelFormatDesc channel_format =
         cudaCreateChannelDesc(8, 8, 8, 8, cudaChannelFormatKindUnsigned);
     std::vector<cudaTextureObject_t> texture_handles;
+    std::vector<uint8_t> rgba_scratch;
     for (const auto &t : scene.textures) {
         textures.emplace_back(glm::uvec2(t.width, t.height), channel_format, t.color_space);
-        textures.back().upload(t.img.data());
+        textures.back().upload(rgba8_pixels(t, rgba_scratch));
         texture_handles.push_back(textures.back().handle());
     }
     device_texture_list.upload(texture_handles);
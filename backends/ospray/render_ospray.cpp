@@ -4,6 +4,7 @@
 #include <iostream>
 #include <limits>
 #include <numeric>
+#include <thread>
 #include <tbb/parallel_for.h>
 #include "texture_channel_mask.h"
 #include "util.h"
@@ -34,6 +35,7 @@ RenderOSPRay::RenderOSPRay() : fb(0)
 
 RenderOSPRay::~RenderOSPRay()
 {
+    cancel_frame();
     for (auto &t : textures) {
         ospRelease(t);
     }
@@ -57,37 +59,68 @@ std::string RenderOSPRay::name()
     return "OSPRay";
 }
 
+bool RenderOSPRay::supports_render_thread()
+{
+    return true;
+}
+
+bool RenderOSPRay::supports_feature(const RenderFeature feature)
+{
+    return feature == RenderFeature::VARIANCE_THRESHOLD;
+}
+
 void RenderOSPRay::initialize(const int fb_width, const int fb_height)
 {
     float aspect = static_cast<float>(fb_width) / fb_height;
     ospSetParam(camera, "aspect", OSP_FLOAT, &aspect);
 
+    // Tiles whose variance is below the threshold are no longer sampled
+    ospSetParam(renderer, "varianceThreshold", OSP_FLOAT, &variance_threshold);
+    ospCommit(renderer);
+
+    cancel_frame();
     if (fb) {
         ospRelease(fb);
     }
 
-    fb = ospNewFrameBuffer(fb_width, fb_height, OSP_FB_SRGBA, OSP_FB_COLOR | OSP_FB_ACCUM);
+    fb = ospNewFrameBuffer(
+        fb_width, fb_height, OSP_FB_SRGBA, OSP_FB_COLOR | OSP_FB_ACCUM | OSP_FB_VARIANCE);
     img.resize(fb_width * fb_height);
 }
 
-void RenderOSPRay::set_scene(const Scene &in_scene)
+void RenderOSPRay::set_scene(const std::shared_ptr<const Scene> &in_scene)
 {
+    cancel_frame();
     ospResetAccumulation(fb);
 
-    // TODO: should take scene as shared ptr
     scene = in_scene;
 
-    // Linearize any sRGB textures beforehand, since we don't have fancy sRGB texture
-    // interpolation support in hardware
-    tbb::parallel_for(size_t(0), scene.textures.size(), [&](size_t i) {
-        auto &img = scene.textures[i];
-        if (img.color_space == LINEAR) {
+    // Linearize any sRGB color textures beforehand, since we don't have fancy sRGB texture
+    // interpolation support in hardware. OSPRay's only single and two channel formats which
+    // replicate luminance to RGB are the sRGB L8/LA8 ones, so sRGB luminance textures are
+    // shared as is and linear ones are expanded to RGBA. Other linear textures are shared
+    // with OSPRay directly
+    linearized_textures.clear();
+    linearized_textures.resize(scene->textures.size());
+    tbb::parallel_for(size_t(0), scene->textures.size(), [&](size_t i) {
+        const Image &src = scene->textures[i];
+        auto &img = linearized_textures[i];
+        if (src.channels <= 2) {
+            if (src.color_space == LINEAR) {
+                std::vector<uint8_t> rgba;
+                const uint8_t *pixels = rgba8_pixels(src, rgba);
+                img = Image(pixels, src.width, src.height, 4, src.name, LINEAR);
+            }
+            return;
+        }
+        if (src.color_space == LINEAR) {
             return;
         }
+        img = src;
         img.color_space = LINEAR;
-        const int convert_channels = std::min(3, img.channels);
+        // Only the RGB channels are sRGB encoded, alpha is linear
         tbb::parallel_for(size_t(0), size_t(img.width) * img.height, [&](size_t px) {
-            for (int c = 0; c < convert_channels; ++c) {
+            for (int c = 0; c < 3; ++c) {
                 float x = img.img[px * img.channels + c] / 255.f;
                 x = srgb_to_linear(x);
                 img.img[px * img.channels + c] = glm::clamp(x * 255.f, 0.f, 255.f);
@@ -99,9 +132,22 @@ void RenderOSPRay::set_scene(const Scene &in_scene)
         ospRelease(t);
     }
     textures.clear();
-    for (const auto &tex : scene.textures) {
-        const OSPDataType data_type = tex.channels == 3 ? OSP_VEC3UC : OSP_VEC4UC;
-        const int format = tex.channels == 3 ? OSP_TEXTURE_RGB8 : OSP_TEXTURE_RGBA8;
+    for (size_t i = 0; i < scene->textures.size(); ++i) {
+        const Image &tex = linearized_textures[i].img.empty() ? scene->textures[i]
+                                                               : linearized_textures[i];
+        // Only sRGB luminance textures are left with one or two channels at this point
+        OSPDataType data_type = OSP_VEC4UC;
+        int format = OSP_TEXTURE_RGBA8;
+        if (tex.channels == 1) {
+            data_type = OSP_UCHAR;
+            format = OSP_TEXTURE_L8;
+        } else if (tex.channels == 2) {
+            data_type = OSP_VEC2UC;
+            format = OSP_TEXTURE_LA8;
+        } else if (tex.channels == 3) {
+            data_type = OSP_VEC3UC;
+            format = OSP_TEXTURE_RGB8;
+        }
         const int filter = OSP_TEXTURE_FILTER_BILINEAR;
 
         OSPData tex_data =
@@ -118,7 +164,7 @@ void RenderOSPRay::set_scene(const Scene &in_scene)
         ospRelease(m);
     }
     materials.clear();
-    for (const auto &mat : scene.materials) {
+    for (const auto &mat : scene->materials) {
         OSPMaterial m = ospNewMaterial("pathtracer", "principled");
         const int tex_handle = *reinterpret_cast<const int *>(&mat.base_color.x);
         if (IS_TEXTURED_PARAM(tex_handle)) {
@@ -153,11 +199,11 @@ void RenderOSPRay::set_scene(const Scene &in_scene)
     }
 
     std::vector<std::vector<OSPGeometry>> meshes;
-    for (const auto &mesh : scene.meshes) {
+    for (const auto &mesh : scene->meshes) {
         std::vector<OSPGeometry> mesh_geometries;
         for (const auto &geom : mesh.geometries) {
             OSPData verts_data =
-                ospNewSharedData(geom.vertices.data(), OSP_VEC3F, geom.vertices.size());
+                ospNewSharedData(geom.vertices.data(), OSP_VEC3F, geom.num_vertices());
             OSPData indices_data =
                 ospNewSharedData(geom.indices.data(), OSP_VEC3UI, geom.indices.size());
 
@@ -176,16 +222,15 @@ void RenderOSPRay::set_scene(const Scene &in_scene)
         meshes.push_back(mesh_geometries);
     }
 
-    for (auto &i : instances) {
-        ospRelease(i);
-    }
-    instances.clear();
-    for (const auto &inst : scene.instances) {
-        // Make models for each geometry in the instance's mesh to set the material
+    // Build a group for each parameterized mesh, which is shared by all the instances
+    // of it so OSPRay only builds one BLAS for it. The geometric models set the material
+    // for each of the mesh's geometries
+    std::vector<OSPGroup> groups;
+    for (const auto &pm : scene->parameterized_meshes) {
         std::vector<OSPGeometricModel> geom_models;
-        const auto &pm = scene.parameterized_meshes[inst.parameterized_mesh_id];
-        for (size_t i = 0; i < meshes[inst.parameterized_mesh_id].size(); ++i) {
-            OSPGeometricModel gm = ospNewGeometricModel(meshes[inst.parameterized_mesh_id][i]);
+        const auto &mesh_geometries = meshes[pm.mesh_id];
+        for (size_t i = 0; i < mesh_geometries.size(); ++i) {
+            OSPGeometricModel gm = ospNewGeometricModel(mesh_geometries[i]);
             ospSetParam(gm, "material", OSP_UINT, &pm.material_ids[i]);
             ospCommit(gm);
             geom_models.push_back(gm);
@@ -198,20 +243,31 @@ void RenderOSPRay::set_scene(const Scene &in_scene)
         ospCopyData(stage, geom_list);
         ospSetParam(group, "geometry", OSP_DATA, &geom_list);
         ospCommit(group);
-
-        OSPInstance osp_instance = ospNewInstance(group);
-        const glm::mat4x3 m(inst.transform);
-        ospSetParam(osp_instance, "xfm", OSP_AFFINE3F, glm::value_ptr(m));
-        ospCommit(osp_instance);
-        instances.push_back(osp_instance);
+        groups.push_back(group);
 
         // Ref-counted internally by OSPRay, we no longer need these handles
+        ospRelease(stage);
+        ospRelease(geom_list);
         for (auto &gm : geom_models) {
             ospRelease(gm);
         }
-        ospRelease(group);
+    }
+
+    for (auto &i : instances) {
+        ospRelease(i);
+    }
+    instances.clear();
+    for (const auto &inst : scene->instances) {
+        OSPInstance osp_instance = ospNewInstance(groups[inst.parameterized_mesh_id]);
+        const glm::mat4x3 m(inst.transform);
+        ospSetParam(osp_instance, "xfm", OSP_AFFINE3F, glm::value_ptr(m));
+        ospCommit(osp_instance);
+        instances.push_back(osp_instance);
     }
     // Ref-counted internally by OSPRay, we no longer need these handles
+    for (auto &g : groups) {
+        ospRelease(g);
+    }
     for (auto &m : meshes) {
         for (auto &g : m) {
             ospRelease(g);
@@ -222,7 +278,7 @@ void RenderOSPRay::set_scene(const Scene &in_scene)
         ospRelease(l);
     }
     lights.clear();
-    for (const auto &light : scene.lights) {
+    for (const auto &light : scene->lights) {
         OSPLight l = ospNewLight("quad");
 
         const glm::vec3 color = glm::normalize(glm::vec3(light.emission));
@@ -272,6 +328,8 @@ RenderStats RenderOSPRay::render(const glm::vec3 &pos,
 {
     using namespace std::chrono;
     if (camera_changed) {
+        // The frame in flight is for the old camera position
+        cancel_frame();
         ospSetParam(camera, "position", OSP_VEC3F, &pos.x);
         ospSetParam(camera, "direction", OSP_VEC3F, &dir.x);
         ospSetParam(camera, "up", OSP_VEC3F, &up.x);
@@ -281,20 +339,61 @@ RenderStats RenderOSPRay::render(const glm::vec3 &pos,
     }
 
     RenderStats stats;
-    auto start = high_resolution_clock::now();
-    OSPFuture future = ospRenderFrame(fb, renderer, camera, world);
-    ospWait(future);
-    auto end = high_resolution_clock::now();
-    stats.render_time = duration_cast<nanoseconds>(end - start).count() * 1.0e-6;
+    if (!future) {
+        future = ospRenderFrame(fb, renderer, camera, world);
+    }
 
-    const uint32_t *mapped =
-        static_cast<const uint32_t *>(ospMapFrameBuffer(fb, OSP_FB_COLOR));
-    std::memcpy(img.data(), mapped, sizeof(uint32_t) * img.size());
-    ospUnmapFrameBuffer(mapped, fb);
+    if (cancel_token) {
+        // Poll the frame so we can abandon it if the camera moves while it's rendering
+        while (!ospIsReady(future, OSP_TASK_FINISHED)) {
+            if (frame_cancelled()) {
+                cancel_frame();
+                ospResetAccumulation(fb);
+                stats.cancelled = true;
+                return stats;
+            }
+            std::this_thread::sleep_for(microseconds(500));
+        }
+    } else {
+        ospWait(future, OSP_TASK_FINISHED);
+    }
+    stats.render_time = ospGetTaskDuration(future) * 1000.f;
+    ospRelease(future);
+    future = nullptr;
+
+    // The variance isn't estimated until a few frames have been accumulated, until then
+    // OSPRay reports it as infinite
+    stats.variance = ospGetVariance(fb);
+    stats.converged = variance_threshold > 0.f && stats.variance < variance_threshold;
+
+    // The copy has to be done before starting the next frame, as it accumulates into the
+    // same framebuffer. The converged image is always copied, since we stop rendering
+    // once converged it may be the last frame the caller gets
+    if (need_readback || stats.converged) {
+        const uint32_t *mapped =
+            static_cast<const uint32_t *>(ospMapFrameBuffer(fb, OSP_FB_COLOR));
+        std::memcpy(img.data(), mapped, sizeof(uint32_t) * img.size());
+        ospUnmapFrameBuffer(mapped, fb);
+    }
+
+    if (!stats.converged) {
+        future = ospRenderFrame(fb, renderer, camera, world);
+    }
 
     return stats;
 }
 
+void RenderOSPRay::cancel_frame()
+{
+    if (!future) {
+        return;
+    }
+    ospCancel(future);
+    ospWait(future, OSP_TASK_FINISHED);
+    ospRelease(future);
+    future = nullptr;
+}
+
 void RenderOSPRay::set_material_param(OSPMaterial &mat,
                                       const std::string &name,
                                       const float val) const
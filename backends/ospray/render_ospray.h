@@ -1,5 +1,7 @@
 #pragma once
 
+#include <memory>
+#include <vector>
 #include <ospray/ospray.h>
 #include <ospray/ospray_util.h>
 #include "render_backend.h"
@@ -9,8 +11,15 @@ struct RenderOSPRay : RenderBackend {
     OSPRenderer renderer;
     OSPFrameBuffer fb;
     OSPWorld world;
+    // The next frame, started at the end of render() so that it renders while the caller
+    // is displaying the previous one. Null if no frame is in flight
+    OSPFuture future = nullptr;
 
-    Scene scene;
+    // OSPRay shares the scene's geometry and linear textures, so we keep a reference to it
+    std::shared_ptr<const Scene> scene;
+    // Linearized copies of the scene's sRGB color textures and RGBA expanded copies of its
+    // linear luminance textures, empty for the textures shared directly
+    std::vector<Image> linearized_textures;
     std::vector<OSPTexture> textures;
     std::vector<OSPMaterial> materials;
     std::vector<OSPInstance> instances;
@@ -20,8 +29,10 @@ struct RenderOSPRay : RenderBackend {
     ~RenderOSPRay();
 
     std::string name() override;
+    bool supports_render_thread() override;
+    bool supports_feature(const RenderFeature feature) override;
     void initialize(const int fb_width, const int fb_height) override;
-    void set_scene(const Scene &scene) override;
+    void set_scene(const std::shared_ptr<const Scene> &scene) override;
     RenderStats render(const glm::vec3 &pos,
                        const glm::vec3 &dir,
                        const glm::vec3 &up,
@@ -30,5 +41,8 @@ struct RenderOSPRay : RenderBackend {
                        const bool need_readback) override;
 
 private:
+    // Cancel the frame in flight, if any, and wait for it to stop
+    void cancel_frame();
+
     void set_material_param(OSPMaterial &mat, const std::string &name, const float val) const;
 };
@@ -181,8 +181,9 @@ void RenderVulkan::initialize(const int fb_width, const int fb_height)
     }
 }
 
-void RenderVulkan::set_scene(const Scene &scene)
+void RenderVulkan::set_scene(const std::shared_ptr<const Scene> &in_scene)
 {
+    const Scene &scene = *in_scene;
     frame_id = 0;
     samples_per_pixel = scene.samples_per_pixel;
 
@@ -196,7 +197,7 @@ void RenderVulkan::set_scene(const Scene &scene)
         for (const auto &geom : mesh.geometries) {
             // Upload triangle vertices to the device
             auto upload_verts = vkrt::Buffer::host(*device,
-                                                   geom.vertices.size() * sizeof(glm::vec3),
+                                                   geom.num_vertices() * sizeof(glm::vec3),
                                                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
             {
                 void *map = upload_verts->map();
@@ -522,8 +523,9 @@ void RenderVulkan::set_scene(const Scene &scene)
 
         auto upload_buf = vkrt::Buffer::host(
             *device, tex->pixel_size() * t.width * t.height, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+        std::vector<uint8_t> rgba_scratch;
         void *map = upload_buf->map();
-        std::memcpy(map, t.img.data(), upload_buf->size());
+        std::memcpy(map, rgba8_pixels(t, rgba_scratch), upload_buf->size());
         upload_buf->unmap();
 
         VkCommandBufferBeginInfo begin_info = {};
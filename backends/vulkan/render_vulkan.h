@@ -75,7 +75,7 @@ struct RenderVulkan : RenderBackend {
 
     void initialize(const int fb_width, const int fb_height) override;
 
-    void set_scene(const Scene &scene) override;
+    void set_scene(const std::shared_ptr<const Scene> &scene) override;
 
     RenderStats render(const glm::vec3 &pos,
                        const glm::vec3 &dir,
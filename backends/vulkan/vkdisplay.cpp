@@ -340,6 +340,11 @@ void VKDisplay::display(RenderBackend *renderer)
     }
 }
 
+bool VKDisplay::needs_readback(RenderBackend *renderer)
+{
+    return dynamic_cast<RenderVulkan *>(renderer) == nullptr;
+}
+
 void VKDisplay::display_native(std::shared_ptr<vkrt::Texture2D> &img)
 {
     uint32_t back_buffer_idx = 0;
@@ -47,6 +47,8 @@ struct VKDisplay : Display {
 
     void display(RenderBackend *renderer) override;
 
+    bool needs_readback(RenderBackend *renderer) override;
+
     void display_native(std::shared_ptr<vkrt::Texture2D> &img);
 
 private:
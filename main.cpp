@@ -1,15 +1,25 @@
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <numeric>
 #include <sstream>
+#include <thread>
 #include <vector>
 #include <SDL.h>
 #include "arcball_camera.h"
+#include "checkpoint.h"
+#include "image_writer.h"
 #include "imgui.h"
+#include "sample_density.h"
 #include "scene.h"
-#include "stb_image_write.h"
+#include "tiled_image_file.h"
+#include "triple_buffer.h"
 #include "util.h"
 #include "util/display/display.h"
 #include "util/display/gldisplay.h"
@@ -30,16 +40,166 @@ const std::string USAGE =
     "\t-img <x> <y>           Specify the window dimensions. Defaults to 1280x720\n"
     "\t-mat-mode <MODE>       Specify the material mode, default (the default) or "
     "white_diffuse\n"
+    "\t-frame-budget <ms>     Target time per-frame in milliseconds. Backends which support\n"
+    "\t                       it take as many passes of spp samples as fit in the budget\n"
+    "\t-validation-format <FMT>\n"
+    "\t                       Image format for -validation images, png (the default)\n"
+    "\t                       or ppm for fast uncompressed output\n"
+    "\t-variance-threshold <v>\n"
+    "\t                       Stop accumulating once the estimated variance of the image\n"
+    "\t                       falls below <v>, for backends which estimate it. Benchmark\n"
+    "\t                       runs finish early once converged\n"
+    "\t-bvh-quality <Q>       BVH build quality for backends which support it, low,\n"
+    "\t                       medium (the default) or high\n"
+    "\t-bvh-high-max-tris <n> With -bvh-quality high, build meshes with more than n\n"
+    "\t                       triangles at medium quality\n"
+    "\t-bvh-compact           Build compact BVHs to reduce memory use\n"
+    "\t-bvh-robust            Build BVHs for robust rather than fastest traversal\n"
+    "\t-compress-textures     Block compress textures to reduce memory use, for backends\n"
+    "\t                       which support it\n"
+    "\t-texture-mipmaps       Mipmap textures and filter them by the ray footprint, for\n"
+    "\t                       backends which support it\n"
+    "\t-accumulation-format <F>\n"
+    "\t                       Accumulation buffer format for backends which support it,\n"
+    "\t                       fp32 (the default), fp16 or rgb9e5\n"
+    "\t-primary-hit-cache <n> Cache the first hits for n fixed jitter positions per pixel\n"
+    "\t                       while the camera is still, for backends which support it\n"
+    "\t-temporal-reprojection <n>\n"
+    "\t                       Reproject the accumulated image when the camera moves,\n"
+    "\t                       keeping up to n frames of history, for backends which\n"
+    "\t                       support it\n"
+    "\t-preview <I>           Integrator to preview with while the camera moves, for\n"
+    "\t                       backends which support it: albedo, ao, direct or none\n"
+    "\t                       (the default) to always path trace\n"
+    "\t-ao-samples <n>        Ambient occlusion rays per-sample for -preview ao\n"
+    "\t-roi-density <d>       Concentrate samples in a region of interest, sampling pixels\n"
+    "\t                       outside it at <d> times the rate, for backends which support\n"
+    "\t                       it. Ctrl+left drag to draw the region, ctrl+right click to\n"
+    "\t                       clear it\n"
+    "\t-foveate <r>           Include a circle of radius <r> pixels around the mouse in the\n"
+    "\t                       region of interest\n"
+    "\t-density-mask <file>   Grayscale image giving the region of interest's weight over\n"
+    "\t                       the image\n"
+    "\t-poster <x> <y> <file> Render an x by y image offline for backends which support it,\n"
+    "\t                       streaming tiles to <file>.tiles and writing <file> as a PPM\n"
+    "\t                       when done. Rerunning an interrupted render resumes it\n"
+    "\t-poster-passes <n>     Passes of spp samples to take per-pixel for -poster\n"
+    "\t-batch <cameras> <prefix>\n"
+    "\t                       Render an image for each camera in a batch, sharing the loaded\n"
+    "\t                       scene, and write them to <prefix><n>.png. <cameras> is all\n"
+    "\t                       for the scene's cameras or a file with a camera per-line, in\n"
+    "\t                       the -eye -center -up -fov format printed by pressing p\n"
+    "\t-batch-frames <n>      Frames of spp samples to take per-pixel for each -batch view\n"
+    "\t-batch-interleave      Render the -batch views' tiles interleaved so threads don't\n"
+    "\t                       idle at the end of each view, for backends which support it\n"
+    "\t-checkpoint <file> <s> Save the accumulated image to <file> every <s> seconds, for\n"
+    "\t                       backends which support it\n"
+    "\t-resume                Continue accumulating from the -checkpoint file, if it was\n"
+    "\t                       saved for the same scene, camera and render settings\n"
+    "\t-no-render-thread      Render on the UI thread even if the backend supports\n"
+    "\t                       running on a separate render thread\n"
     "\n";
 
 int win_width = 1280;
 int win_height = 720;
 
+// Camera and framebuffer parameters passed from the UI thread to the render thread
+struct RenderParams {
+    glm::vec3 eye;
+    glm::vec3 dir;
+    glm::vec3 up;
+    float fov_y = 65.f;
+    glm::uvec2 fb_dims;
+    // Incremented by the UI thread each time the camera or framebuffer size changes,
+    // making any frame in flight for an older version stale
+    uint64_t version = 0;
+};
+
+// A completed frame published by the render thread for the UI thread to display
+struct RenderedFrame {
+    std::vector<uint32_t> img;
+    std::vector<glm::uvec4> dirty_regions;
+    bool full_image_dirty = true;
+    glm::uvec2 fb_dims;
+    RenderStats stats;
+    // Running totals over the accumulated frames, the same as those tracked by
+    // the UI thread when rendering inline
+    size_t frame_id = 0;
+    float render_time = 0.f;
+    float rays_per_second = 0.f;
+    // Incremented for each frame published, so the UI can tell if it skipped any
+    uint64_t sequence = 0;
+    bool benchmark_done = false;
+};
+
+/* Drives the renderer from its own thread so a slow frame doesn't block the SDL event loop
+ * and UI. Camera updates come in through the params mailbox and completed frames are
+ * published through the frames triple buffer, neither side ever blocks the other.
+ * When the UI publishes new params it also bumps the cancellation token, letting the
+ * renderer abandon the now stale frame it's working on.
+ */
+struct RenderThread {
+    RenderBackend *renderer = nullptr;
+    TripleBuffer<RenderParams> params;
+    TripleBuffer<RenderedFrame> frames;
+    std::shared_ptr<CancellationToken> cancel_token;
+    std::atomic<bool> quit;
+    size_t benchmark_frames = 0;
+    // Validation images are written for every frame rendered, so must be queued from the
+    // render thread. Empty if not running validation
+    std::string validation_img_prefix;
+    std::string validation_img_ext;
+    ImageWriter *image_writer = nullptr;
+    // Optional, if set the accumulated image is checkpointed periodically
+    CheckpointWriter *checkpoint_writer = nullptr;
+    AccumulationState *checkpoint_state = nullptr;
+    uint64_t scene_hash = 0;
+    // The integrator to render frames for a new camera position with, so it's used while
+    // the camera is moving
+    Integrator preview_integrator = Integrator::PATH_TRACER;
+    // Per-pixel sample density published by the UI thread when variable sample density
+    // is enabled
+    TripleBuffer<std::vector<float>> sample_density;
+    // Set if the renderer's accumulated image was restored from a checkpoint for the
+    // initial camera, so the first frame continues accumulating into it
+    bool resumed = false;
+
+    RenderThread(RenderBackend *renderer,
+                 const size_t benchmark_frames,
+                 const std::string &validation_img_prefix,
+                 const std::string &validation_img_ext,
+                 ImageWriter *image_writer);
+
+    RenderThread(const RenderThread &) = delete;
+    RenderThread &operator=(const RenderThread &) = delete;
+
+    void run(glm::uvec2 fb_dims);
+};
+
 void run_app(const std::vector<std::string> &args,
              SDL_Window *window,
              Display *display,
              RenderPlugin *render_plugin);
 
+// Save the renderer's accumulated image if a checkpoint is due, must be called between frames
+void checkpoint_accumulation(RenderBackend *renderer,
+                             CheckpointWriter *writer,
+                             AccumulationState &state,
+                             const glm::vec3 &eye,
+                             const glm::vec3 &dir,
+                             const glm::vec3 &up,
+                             const float fov_y,
+                             const uint64_t scene_hash);
+
+bool read_camera_file(const std::string &fname, std::vector<Camera> &cameras);
+
+void run_batch(RenderBackend *renderer,
+               const std::vector<Camera> &cameras,
+               const glm::uvec2 &fb_dims,
+               const std::string &prefix,
+               const uint32_t frames,
+               const bool interleave);
+
 glm::vec2 transform_mouse(glm::vec2 in)
 {
     return glm::vec2(in.x * 2.f / win_width - 1.f, 1.f - 2.f * in.y / win_height);
@@ -124,10 +284,37 @@ void run_app(const std::vector<std::string> &args,
     glm::vec3 up(0, 1, 0);
     float fov_y = 65.f;
     uint32_t samples_per_pixel = 1;
+    float frame_time_budget = 0.f;
+    float variance_threshold = 0.f;
+    BVHQuality bvh_quality = BVHQuality::MEDIUM;
+    size_t bvh_high_quality_max_tris = 0;
+    bool bvh_compact = false;
+    bool bvh_robust = false;
+    bool compress_textures = false;
+    bool texture_mipmaps = false;
+    AccumulationFormat accumulation_format = AccumulationFormat::FP32;
+    uint32_t primary_hit_cache_jitters = 0;
+    uint32_t temporal_reprojection_frames = 0;
+    Integrator preview_integrator = Integrator::PATH_TRACER;
+    uint32_t ao_samples = 4;
+    bool variable_sample_density = false;
+    SampleDensityRegion density_region;
     size_t camera_id = 0;
     size_t benchmark_frames = 0;
     std::string validation_img_prefix;
+    std::string validation_img_ext = "png";
     MaterialMode material_mode = MaterialMode::DEFAULT;
+    bool allow_render_thread = true;
+    std::string poster_file;
+    glm::uvec2 poster_dims(0);
+    uint32_t poster_passes = 1;
+    std::string batch_cameras_file;
+    std::string batch_prefix;
+    uint32_t batch_frames = 1;
+    bool batch_interleave = false;
+    std::string checkpoint_file;
+    float checkpoint_interval = 0.f;
+    bool resume = false;
     for (size_t i = 1; i < args.size(); ++i) {
         if (args[i] == "-eye") {
             eye.x = std::stof(args[++i]);
@@ -149,10 +336,83 @@ void run_app(const std::vector<std::string> &args,
             got_camera_args = true;
         } else if (args[i] == "-spp") {
             samples_per_pixel = std::stoi(args[++i]);
+        } else if (args[i] == "-frame-budget") {
+            frame_time_budget = std::stof(args[++i]);
+        } else if (args[i] == "-variance-threshold") {
+            variance_threshold = std::stof(args[++i]);
+        } else if (args[i] == "-bvh-quality") {
+            const std::string quality = args[++i];
+            if (quality == "low") {
+                bvh_quality = BVHQuality::LOW;
+            } else if (quality == "high") {
+                bvh_quality = BVHQuality::HIGH;
+            } else if (quality != "medium") {
+                std::cout << "Error: Invalid BVH quality " << quality << "\n" << USAGE;
+                std::exit(1);
+            }
+        } else if (args[i] == "-bvh-high-max-tris") {
+            bvh_high_quality_max_tris = std::stoull(args[++i]);
+        } else if (args[i] == "-bvh-compact") {
+            bvh_compact = true;
+        } else if (args[i] == "-bvh-robust") {
+            bvh_robust = true;
+        } else if (args[i] == "-compress-textures") {
+            compress_textures = true;
+        } else if (args[i] == "-texture-mipmaps") {
+            texture_mipmaps = true;
+        } else if (args[i] == "-accumulation-format") {
+            const std::string format = args[++i];
+            if (format == "fp16") {
+                accumulation_format = AccumulationFormat::FP16;
+            } else if (format == "rgb9e5") {
+                accumulation_format = AccumulationFormat::RGB9E5;
+            } else if (format != "fp32") {
+                std::cout << "Error: Invalid accumulation format " << format << "\n" << USAGE;
+                std::exit(1);
+            }
+        } else if (args[i] == "-primary-hit-cache") {
+            primary_hit_cache_jitters = std::stoi(args[++i]);
+        } else if (args[i] == "-temporal-reprojection") {
+            temporal_reprojection_frames = std::stoi(args[++i]);
+        } else if (args[i] == "-preview") {
+            const std::string preview = args[++i];
+            if (preview == "albedo") {
+                preview_integrator = Integrator::ALBEDO;
+            } else if (preview == "ao") {
+                preview_integrator = Integrator::AMBIENT_OCCLUSION;
+            } else if (preview == "direct") {
+                preview_integrator = Integrator::DIRECT_LIGHTING;
+            } else if (preview != "none") {
+                std::cout << "Error: Invalid preview integrator " << preview << "\n" << USAGE;
+                std::exit(1);
+            }
+        } else if (args[i] == "-ao-samples") {
+            ao_samples = std::stoi(args[++i]);
+        } else if (args[i] == "-roi-density") {
+            density_region.min_density = std::stof(args[++i]);
+            variable_sample_density = true;
+        } else if (args[i] == "-foveate") {
+            density_region.fovea_radius = std::stof(args[++i]);
+            variable_sample_density = true;
+        } else if (args[i] == "-density-mask") {
+            const std::string mask_file = args[++i];
+            if (!density_region.load_mask(mask_file)) {
+                std::cout << "Error: Failed to load density mask " << mask_file << "\n";
+                std::exit(1);
+            }
+            variable_sample_density = true;
         } else if (args[i] == "-camera") {
             camera_id = std::stol(args[++i]);
         } else if (args[i] == "-validation") {
             validation_img_prefix = args[++i];
+        } else if (args[i] == "-validation-format") {
+            validation_img_ext = args[++i];
+            if (validation_img_ext != "png" && validation_img_ext != "ppm") {
+                std::cout << "Error: Unsupported validation image format "
+                          << validation_img_ext << "\n"
+                          << USAGE;
+                std::exit(1);
+            }
         } else if (args[i] == "-img") {
             i += 2;
         } else if (args[i] == "-mat-mode") {
@@ -161,6 +421,26 @@ void run_app(const std::vector<std::string> &args,
             }
         } else if (args[i] == "-benchmark-frames") {
             benchmark_frames = std::stoi(args[++i]);
+        } else if (args[i] == "-no-render-thread") {
+            allow_render_thread = false;
+        } else if (args[i] == "-poster") {
+            poster_dims.x = std::stoi(args[++i]);
+            poster_dims.y = std::stoi(args[++i]);
+            poster_file = args[++i];
+        } else if (args[i] == "-poster-passes") {
+            poster_passes = std::stoi(args[++i]);
+        } else if (args[i] == "-batch") {
+            batch_cameras_file = args[++i];
+            batch_prefix = args[++i];
+        } else if (args[i] == "-batch-frames") {
+            batch_frames = std::max(std::stoi(args[++i]), 1);
+        } else if (args[i] == "-batch-interleave") {
+            batch_interleave = true;
+        } else if (args[i] == "-checkpoint") {
+            checkpoint_file = args[++i];
+            checkpoint_interval = std::stof(args[++i]);
+        } else if (args[i] == "-resume") {
+            resume = true;
         } else if (args[i][0] != '-') {
             scene_file = args[i];
             canonicalize_path(scene_file);
@@ -177,58 +457,252 @@ void run_app(const std::vector<std::string> &args,
         std::cout << "Error: No model file specified\n" << USAGE;
         std::exit(1);
     }
+    if (resume && checkpoint_file.empty()) {
+        std::cout << "Error: -resume requires a -checkpoint file\n" << USAGE;
+        std::exit(1);
+    }
+    // Reject settings the backend would otherwise silently ignore
+    auto require_feature = [&](const bool used, const RenderFeature feature, const char *opt) {
+        if (used && !renderer->supports_feature(feature)) {
+            std::cout << "Error: The " << renderer->name() << " backend does not support "
+                      << opt << "\n";
+            std::exit(1);
+        }
+    };
+    require_feature(
+        frame_time_budget > 0.f, RenderFeature::FRAME_TIME_BUDGET, "-frame-budget");
+    require_feature(
+        variance_threshold > 0.f, RenderFeature::VARIANCE_THRESHOLD, "-variance-threshold");
+    require_feature(bvh_quality != BVHQuality::MEDIUM || bvh_high_quality_max_tris > 0 ||
+                        bvh_compact || bvh_robust,
+                    RenderFeature::BVH_OPTIONS,
+                    "the -bvh-* options");
+    require_feature(
+        compress_textures, RenderFeature::COMPRESSED_TEXTURES, "-compress-textures");
+    require_feature(texture_mipmaps, RenderFeature::TEXTURE_MIPMAPS, "-texture-mipmaps");
+    require_feature(accumulation_format != AccumulationFormat::FP32,
+                    RenderFeature::ACCUMULATION_FORMAT,
+                    "-accumulation-format");
+    require_feature(
+        primary_hit_cache_jitters > 0, RenderFeature::PRIMARY_HIT_CACHE, "-primary-hit-cache");
+    require_feature(temporal_reprojection_frames > 0,
+                    RenderFeature::TEMPORAL_REPROJECTION,
+                    "-temporal-reprojection");
+    require_feature(preview_integrator != Integrator::PATH_TRACER,
+                    RenderFeature::PREVIEW_INTEGRATORS,
+                    "-preview");
+    require_feature(variable_sample_density,
+                    RenderFeature::VARIABLE_SAMPLE_DENSITY,
+                    "-roi-density, -foveate or -density-mask");
+    require_feature(!checkpoint_file.empty(), RenderFeature::CHECKPOINT, "-checkpoint");
+    // Each batch view must start from scratch, not from the previous view's reprojected
+    // image or cached hits
+    if (!batch_prefix.empty() &&
+        (temporal_reprojection_frames > 0 || primary_hit_cache_jitters > 0)) {
+        std::cout << "Error: -batch can't be used with -temporal-reprojection or "
+                     "-primary-hit-cache\n"
+                  << USAGE;
+        std::exit(1);
+    }
+
+    renderer->frame_time_budget = frame_time_budget;
+    renderer->variance_threshold = variance_threshold;
+    renderer->bvh_quality = bvh_quality;
+    renderer->bvh_high_quality_max_tris = bvh_high_quality_max_tris;
+    renderer->bvh_compact = bvh_compact;
+    renderer->bvh_robust = bvh_robust;
+    renderer->compress_textures = compress_textures;
+    renderer->texture_mipmaps = texture_mipmaps;
+    renderer->accumulation_format = accumulation_format;
+    renderer->primary_hit_cache_jitters = primary_hit_cache_jitters;
+    renderer->temporal_reprojection_frames = temporal_reprojection_frames;
+    renderer->ao_samples = ao_samples;
+    renderer->variable_sample_density = variable_sample_density;
 
     display->resize(win_width, win_height);
     renderer->initialize(win_width, win_height);
 
     std::string scene_info;
+    uint64_t scene_hash = 0;
+    std::vector<Camera> batch_cameras;
     {
-        Scene scene(scene_file, material_mode);
-        scene.samples_per_pixel = samples_per_pixel;
+        // Backends which still need the scene after set_scene keep their own reference to
+        // it, otherwise it's freed at the end of this block
+        auto scene = std::make_shared<Scene>(scene_file, material_mode);
+        scene->samples_per_pixel = samples_per_pixel;
 
         std::stringstream ss;
         ss << "Scene '" << scene_file << "':\n"
-           << "# Unique Triangles: " << pretty_print_count(scene.unique_tris()) << "\n"
-           << "# Total Triangles: " << pretty_print_count(scene.total_tris()) << "\n"
-           << "# Geometries: " << scene.num_geometries() << "\n"
-           << "# Meshes: " << scene.meshes.size() << "\n"
-           << "# Parameterized Meshes: " << scene.parameterized_meshes.size() << "\n"
-           << "# Instances: " << scene.instances.size() << "\n"
-           << "# Materials: " << scene.materials.size() << "\n"
-           << "# Textures: " << scene.textures.size() << "\n"
-           << "# Lights: " << scene.lights.size() << "\n"
-           << "# Cameras: " << scene.cameras.size() << "\n"
-           << "# Samples per Pixel: " << scene.samples_per_pixel;
+           << "# Unique Triangles: " << pretty_print_count(scene->unique_tris()) << "\n"
+           << "# Total Triangles: " << pretty_print_count(scene->total_tris()) << "\n"
+           << "# Geometries: " << scene->num_geometries() << "\n"
+           << "# Meshes: " << scene->meshes.size() << "\n"
+           << "# Parameterized Meshes: " << scene->parameterized_meshes.size() << "\n"
+           << "# Instances: " << scene->instances.size() << "\n"
+           << "# Materials: " << scene->materials.size() << "\n"
+           << "# Textures: " << scene->textures.size() << "\n"
+           << "# Lights: " << scene->lights.size() << "\n"
+           << "# Cameras: " << scene->cameras.size() << "\n"
+           << "# Samples per Pixel: " << scene->samples_per_pixel;
 
+        renderer->set_scene(scene);
+
+        size_t scene_texture_bytes = 0;
+        for (const auto &t : scene->textures) {
+            scene_texture_bytes += t.img.size();
+        }
+        ss << "\n# Texture Memory: " << scene_texture_bytes / (1024 * 1024) << "MB";
+        if (renderer->texture_memory() > 0) {
+            ss << "\n# Backend Texture Memory: " << renderer->texture_memory() / (1024 * 1024)
+               << "MB";
+        }
         scene_info = ss.str();
         std::cout << scene_info << "\n";
 
-        renderer->set_scene(scene);
+        // Identifies the scene and settings a checkpoint's accumulated image was rendered
+        // with, the framebuffer size and accumulation format are checked by the backend
+        const std::string backend_name = renderer->name();
+        const uint64_t scene_params[] = {uint64_t(scene->total_tris()),
+                                         uint64_t(scene->materials.size()),
+                                         uint64_t(scene->textures.size()),
+                                         uint64_t(scene->lights.size()),
+                                         uint64_t(samples_per_pixel),
+                                         uint64_t(material_mode),
+                                         uint64_t(texture_mipmaps),
+                                         uint64_t(compress_textures)};
+        scene_hash = hash_bytes(scene_file.data(), scene_file.size());
+        scene_hash = hash_bytes(backend_name.data(), backend_name.size(), scene_hash);
+        scene_hash = hash_bytes(scene_params, sizeof(scene_params), scene_hash);
 
-        if (!got_camera_args && !scene.cameras.empty()) {
-            eye = scene.cameras[camera_id].position;
-            center = scene.cameras[camera_id].center;
-            up = scene.cameras[camera_id].up;
-            fov_y = scene.cameras[camera_id].fov_y;
+        if (batch_cameras_file == "all") {
+            batch_cameras = scene->cameras;
+        }
+
+        if (!got_camera_args && !scene->cameras.empty()) {
+            eye = scene->cameras[camera_id].position;
+            center = scene->cameras[camera_id].center;
+            up = scene->cameras[camera_id].up;
+            fov_y = scene->cameras[camera_id].fov_y;
         }
     }
 
     ArcballCamera camera(eye, center, up);
 
+    if (!poster_file.empty()) {
+        const std::string tiles_file = poster_file + ".tiles";
+        TiledImageFile poster(tiles_file, poster_dims, glm::uvec2(256));
+        std::cout << "Rendering " << poster_dims.x << "x" << poster_dims.y << " poster to "
+                  << poster_file << ", " << poster.tiles_remaining() << "/"
+                  << poster.num_tiles() << " tiles remaining\n";
+        if (!renderer->render_poster(
+                poster, camera.eye(), camera.dir(), camera.up(), fov_y, poster_passes)) {
+            std::cout << "Error: The " << renderer->name()
+                      << " backend does not support -poster\n";
+            std::exit(1);
+        }
+        if (!poster.write_ppm(poster_file)) {
+            std::cout << "Error: Failed to write " << poster_file << "\n";
+            std::exit(1);
+        }
+        // The tiles are kept until the image is written so a failed write can be retried
+        std::remove(tiles_file.c_str());
+        return;
+    }
+
+    if (!batch_prefix.empty()) {
+        if (batch_cameras_file != "all" &&
+            !read_camera_file(batch_cameras_file, batch_cameras)) {
+            std::cout << "Error: Failed to read cameras from " << batch_cameras_file << "\n";
+            std::exit(1);
+        }
+        if (batch_cameras.empty()) {
+            std::cout << "Error: No cameras to render for -batch\n";
+            std::exit(1);
+        }
+        run_batch(renderer.get(),
+                  batch_cameras,
+                  glm::uvec2(win_width, win_height),
+                  batch_prefix,
+                  batch_frames,
+                  batch_interleave);
+        return;
+    }
+
+    // Checkpoints are saved by the render loop, either on the UI or render thread. The
+    // writer waits for a checkpoint being written when it's destroyed
+    std::unique_ptr<CheckpointWriter> checkpoint_writer;
+    AccumulationState checkpoint_state;
+    bool resumed = false;
+    if (!checkpoint_file.empty()) {
+        if (resume) {
+            const uint64_t camera_hash =
+                hash_camera(camera.eye(), camera.dir(), camera.up(), fov_y);
+            resumed = read_checkpoint(checkpoint_file, checkpoint_state) &&
+                      checkpoint_state.scene_hash == scene_hash &&
+                      checkpoint_state.camera_hash == camera_hash &&
+                      renderer->restore_accumulation(checkpoint_state);
+            if (resumed) {
+                std::cout << "Resuming from " << checkpoint_file << " after "
+                          << checkpoint_state.frame_id << " accumulated frames\n";
+            } else {
+                std::cout << "Checkpoint " << checkpoint_file
+                          << " is missing or doesn't match the scene, camera and render "
+                             "settings, starting from scratch\n";
+            }
+        }
+        checkpoint_writer =
+            std::make_unique<CheckpointWriter>(checkpoint_file, checkpoint_interval);
+    }
+
     const std::string rt_backend = renderer->name();
     const std::string cpu_brand = get_cpu_brand();
     const std::string gpu_brand = display->gpu_brand();
     const std::string image_output = "chameleonrt.png";
     const std::string display_frontend = display->name();
 
+    // Images are encoded and written on background threads so that writing them doesn't
+    // hold up rendering. The writer waits for any pending writes when it's destroyed
+    ImageWriter image_writer;
+
+    // CPU backends can be driven from a render thread, so a slow frame doesn't stall the
+    // UI. The render thread's frames are displayed by uploading them to the GL display
+    GLDisplay *gl_display = dynamic_cast<GLDisplay *>(display);
+    std::unique_ptr<RenderThread> render_thread;
+    std::thread render_thread_handle;
+    if (allow_render_thread && gl_display && renderer->supports_render_thread()) {
+        std::string validation_prefix;
+        if (!validation_img_prefix.empty()) {
+            validation_prefix = validation_img_prefix + render_plugin->get_name();
+        }
+        render_thread = std::make_unique<RenderThread>(renderer.get(),
+                                                       benchmark_frames,
+                                                       validation_prefix,
+                                                       validation_img_ext,
+                                                       &image_writer);
+        render_thread->checkpoint_writer = checkpoint_writer.get();
+        render_thread->checkpoint_state = &checkpoint_state;
+        render_thread->scene_hash = scene_hash;
+        render_thread->resumed = resumed;
+        render_thread->preview_integrator = preview_integrator;
+    }
+
     size_t frame_id = 0;
     float render_time = 0.f;
     float rays_per_second = 0.f;
+    RenderStats stats;
+    uint64_t params_version = 0;
+    uint64_t displayed_sequence = 0;
     glm::vec2 prev_mouse(-2.f);
+    // Corner the region of interest rectangle is being dragged from, if drawing one
+    glm::vec2 roi_drag_start(-1.f);
+    bool density_changed = variable_sample_density;
     bool done = false;
-    bool camera_changed = true;
+    // A restored accumulated image is for the initial camera, so keep accumulating into it
+    bool camera_changed = !resumed;
+    bool params_changed = true;
     bool save_image = false;
     while (!done) {
+        const auto ui_frame_start = std::chrono::steady_clock::now();
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
             ImGui_ImplSDL2_ProcessEvent(&event);
@@ -254,11 +728,38 @@ void run_app(const std::vector<std::string> &args,
                 event.window.windowID == SDL_GetWindowID(window)) {
                 done = true;
             }
+            if (!io.WantCaptureMouse && variable_sample_density) {
+                const bool ctrl = SDL_GetModState() & KMOD_CTRL;
+                if (event.type == SDL_MOUSEBUTTONDOWN && ctrl) {
+                    if (event.button.button == SDL_BUTTON_LEFT) {
+                        roi_drag_start = glm::vec2(event.button.x, event.button.y);
+                    } else if (event.button.button == SDL_BUTTON_RIGHT) {
+                        density_region.rect = glm::vec4(0.f);
+                        density_changed = true;
+                    }
+                } else if (event.type == SDL_MOUSEBUTTONUP &&
+                           event.button.button == SDL_BUTTON_LEFT) {
+                    roi_drag_start = glm::vec2(-1.f);
+                } else if (event.type == SDL_MOUSEMOTION) {
+                    const glm::vec2 pos(event.motion.x, event.motion.y);
+                    if (roi_drag_start.x >= 0.f) {
+                        const glm::vec2 lo = glm::min(roi_drag_start, pos);
+                        const glm::vec2 hi = glm::max(roi_drag_start, pos);
+                        density_region.rect = glm::vec4(lo, hi - lo);
+                        density_changed = true;
+                    }
+                    if (density_region.fovea_radius > 0.f) {
+                        density_region.cursor = pos;
+                        density_changed = true;
+                    }
+                }
+            }
             if (!io.WantCaptureMouse) {
                 if (event.type == SDL_MOUSEMOTION) {
                     const glm::vec2 cur_mouse =
                         transform_mouse(glm::vec2(event.motion.x, event.motion.y));
-                    if (prev_mouse != glm::vec2(-2.f)) {
+                    // Drawing the region of interest doesn't move the camera
+                    if (prev_mouse != glm::vec2(-2.f) && roi_drag_start.x < 0.f) {
                         if (event.motion.state & SDL_BUTTON_LMASK) {
                             camera.rotate(prev_mouse, cur_mouse);
                             camera_changed = true;
@@ -282,57 +783,140 @@ void run_app(const std::vector<std::string> &args,
                 io.DisplaySize.y = win_height;
 
                 display->resize(win_width, win_height);
-                renderer->initialize(win_width, win_height);
+                density_changed = variable_sample_density;
+                // The render thread re-initializes the renderer when it sees the new size
+                if (render_thread) {
+                    params_changed = true;
+                } else {
+                    // The new framebuffer is empty, so render it even if the image for the
+                    // old size had converged
+                    renderer->initialize(win_width, win_height);
+                    camera_changed = true;
+                }
             }
         }
 
-        if (camera_changed) {
-            frame_id = 0;
+        // The density map is recomputed on the UI thread and passed to the renderer with
+        // the next frame, it doesn't reset accumulation as the renderer weights the
+        // samples taken by each pixel
+        if (density_changed) {
+            if (render_thread) {
+                density_region.compute_density(glm::uvec2(win_width, win_height),
+                                               render_thread->sample_density.back_buffer());
+                render_thread->sample_density.publish();
+            } else {
+                density_region.compute_density(glm::uvec2(win_width, win_height),
+                                               renderer->sample_density);
+                stats.converged = false;
+            }
+            density_changed = false;
         }
 
         bool benchmark_done = false;
-        if (benchmark_frames > 0 && frame_id + 1 == benchmark_frames) {
-            save_image = true;
-            benchmark_done = true;
-        }
+        if (render_thread) {
+            if (camera_changed) {
+                params_changed = true;
+                camera_changed = false;
+            }
+            if (params_changed) {
+                ++params_version;
+                RenderParams &params = render_thread->params.back_buffer();
+                params.eye = camera.eye();
+                params.dir = camera.dir();
+                params.up = camera.up();
+                params.fov_y = fov_y;
+                params.fb_dims = glm::uvec2(win_width, win_height);
+                params.version = params_version;
+                render_thread->params.publish();
+                render_thread->cancel_token->generation = params_version;
+                params_changed = false;
+            }
+            // Start the render thread once it has its initial parameters
+            if (!render_thread_handle.joinable()) {
+                render_thread_handle = std::thread(
+                    &RenderThread::run, render_thread.get(), glm::uvec2(win_width, win_height));
+            }
+            if (render_thread->frames.update()) {
+                const RenderedFrame &frame = render_thread->frames.front_buffer();
+                stats = frame.stats;
+                frame_id = frame.frame_id;
+                render_time = frame.render_time;
+                rays_per_second = frame.rays_per_second;
+                if (frame.benchmark_done) {
+                    save_image = true;
+                    benchmark_done = true;
+                }
+            }
+        } else if (camera_changed || !stats.converged) {
+            // Once the image has converged we stop rendering until the camera moves
+            if (camera_changed) {
+                frame_id = 0;
+            }
 
-        const bool need_readback = save_image || !validation_img_prefix.empty();
-        RenderStats stats = renderer->render(
-            camera.eye(), camera.dir(), camera.up(), fov_y, camera_changed, need_readback);
+            if (benchmark_frames > 0 && frame_id + 1 == benchmark_frames) {
+                save_image = true;
+                benchmark_done = true;
+            }
 
-        ++frame_id;
-        camera_changed = false;
+            const bool need_readback = save_image || !validation_img_prefix.empty() ||
+                                       display->needs_readback(renderer.get());
+            // Preview while the camera is moving, once it stops we go back to path tracing
+            renderer->integrator =
+                camera_changed ? preview_integrator : Integrator::PATH_TRACER;
+            stats = renderer->render(
+                camera.eye(), camera.dir(), camera.up(), fov_y, camera_changed, need_readback);
+
+            ++frame_id;
+            camera_changed = false;
+
+            if (checkpoint_writer) {
+                checkpoint_accumulation(renderer.get(),
+                                        checkpoint_writer.get(),
+                                        checkpoint_state,
+                                        camera.eye(),
+                                        camera.dir(),
+                                        camera.up(),
+                                        fov_y,
+                                        scene_hash);
+            }
+
+            if (benchmark_frames > 0 && stats.converged) {
+                save_image = true;
+                benchmark_done = true;
+            }
+
+            if (!validation_img_prefix.empty()) {
+                const std::string img_name = validation_img_prefix +
+                                             render_plugin->get_name() + "-f" +
+                                             std::to_string(frame_id) + "." +
+                                             validation_img_ext;
+                image_writer.write(
+                    img_name, glm::uvec2(win_width, win_height), renderer->img.data());
+            }
+
+            if (frame_id == 1) {
+                render_time = stats.render_time;
+                rays_per_second = stats.rays_per_second;
+            } else {
+                render_time += stats.render_time;
+                rays_per_second += stats.rays_per_second;
+            }
+        }
 
-        if (save_image) {
+        if (save_image && frame_id > 0) {
             save_image = false;
             std::cout << "Image saved to " << image_output << "\n";
-            stbi_write_png(image_output.c_str(),
-                           win_width,
-                           win_height,
-                           4,
-                           renderer->img.data(),
-                           4 * win_width);
-        }
-        if (!validation_img_prefix.empty()) {
-            const std::string img_name = validation_img_prefix + render_plugin->get_name() +
-                                         "-f" + std::to_string(frame_id) + ".png";
-            stbi_write_png(img_name.c_str(),
-                           win_width,
-                           win_height,
-                           4,
-                           renderer->img.data(),
-                           4 * win_width);
+            if (render_thread) {
+                const RenderedFrame &frame = render_thread->frames.front_buffer();
+                image_writer.write(image_output, frame.fb_dims, frame.img.data());
+            } else {
+                image_writer.write(
+                    image_output, glm::uvec2(win_width, win_height), renderer->img.data());
+            }
         }
 
-        if (frame_id == 1) {
-            render_time = stats.render_time;
-            rays_per_second = stats.rays_per_second;
-        } else {
-            render_time += stats.render_time;
-            rays_per_second += stats.rays_per_second;
-        }
         if (benchmark_done) {
-            std::cout << "Benchmarked " << benchmark_frames << " frames\n"
+            std::cout << "Benchmarked " << frame_id << " frames\n"
                       << "Render Time: " << render_time / frame_id << "ms/frame ("
                       << 1000.f / (render_time / frame_id) << " FPS)\n";
             if (stats.rays_per_second > 0) {
@@ -341,6 +925,14 @@ void run_app(const std::vector<std::string> &args,
                 std::cout << "Rays per-second " << rays_per_second / frame_id << " Ray/s ("
                           << rays_per_sec << "Ray/s)\n";
             }
+            if (stats.samples_per_pixel > 0) {
+                std::cout << "Samples per-pixel in last frame: " << stats.samples_per_pixel
+                          << "\n";
+            }
+            if (stats.variance >= 0.f) {
+                std::cout << "Variance: " << stats.variance
+                          << (stats.converged ? " (converged)\n" : "\n");
+            }
             done = true;
         }
 
@@ -350,15 +942,25 @@ void run_app(const std::vector<std::string> &args,
         ImGui::NewFrame();
 
         ImGui::Begin("Render Info");
-        ImGui::Text("Render Time: %.3f ms/frame (%.1f FPS)",
-                    render_time / frame_id,
-                    1000.f / (render_time / frame_id));
+        if (frame_id > 0) {
+            ImGui::Text("Render Time: %.3f ms/frame (%.1f FPS)",
+                        render_time / frame_id,
+                        1000.f / (render_time / frame_id));
+        }
 
         if (stats.rays_per_second > 0) {
             const std::string rays_per_sec = pretty_print_count(rays_per_second / frame_id);
             ImGui::Text("Rays per-second: %sRay/s", rays_per_sec.c_str());
         }
 
+        if (stats.variance >= 0.f) {
+            ImGui::Text("Variance: %f%s", stats.variance, stats.converged ? " (converged)" : "");
+        }
+
+        if (stats.samples_per_pixel > 0) {
+            ImGui::Text("Samples per-pixel per-frame: %u", stats.samples_per_pixel);
+        }
+
         ImGui::Text("Total Application Time: %.3f ms/frame (%.1f FPS)",
                     1000.0f / ImGui::GetIO().Framerate,
                     ImGui::GetIO().Framerate);
@@ -367,6 +969,7 @@ void run_app(const std::vector<std::string> &args,
         ImGui::Text("GPU: %s", gpu_brand.c_str());
         ImGui::Text("Accumulated Frames: %llu", frame_id);
         ImGui::Text("Display Frontend: %s", display_frontend.c_str());
+        ImGui::Text("Render Thread: %s", render_thread ? "Yes" : "No");
         ImGui::Text("%s", scene_info.c_str());
 
         if (ImGui::Button("Save Image")) {
@@ -374,8 +977,285 @@ void run_app(const std::vector<std::string> &args,
         }
 
         ImGui::End();
+
+        if (density_region.rect.z > 0.f && density_region.rect.w > 0.f) {
+            ImGui::GetForegroundDrawList()->AddRect(
+                ImVec2(density_region.rect.x, density_region.rect.y),
+                ImVec2(density_region.rect.x + density_region.rect.z,
+                       density_region.rect.y + density_region.rect.w),
+                IM_COL32(255, 255, 0, 255));
+        }
+
         ImGui::Render();
 
-        display->display(renderer.get());
+        if (render_thread) {
+            // Frames are only uploaded when a new one has been published at the current
+            // window size, otherwise we just redraw the last one along with the UI
+            const RenderedFrame &frame = render_thread->frames.front_buffer();
+            if (frame.sequence != displayed_sequence &&
+                frame.fb_dims == glm::uvec2(win_width, win_height)) {
+                // The dirty regions are relative to the previous frame, if we skipped
+                // some frames we need to upload the whole image
+                const bool sequential = frame.sequence == displayed_sequence + 1;
+                gl_display->upload_image(frame.img.data(),
+                                         frame.full_image_dirty || !sequential,
+                                         frame.dirty_regions);
+                displayed_sequence = frame.sequence;
+            }
+            gl_display->display_native(gl_display->render_texture);
+        } else {
+            display->display(renderer.get());
+        }
+
+        // The UI is run at the display's refresh rate, independent of how long frames take
+        // to render. When rendering inline the frames pace the UI instead, unless the image
+        // has converged and there's nothing to render
+        if (render_thread || stats.converged) {
+            SDL_DisplayMode display_mode;
+            int refresh_rate = 60;
+            if (SDL_GetWindowDisplayMode(window, &display_mode) == 0 &&
+                display_mode.refresh_rate > 0) {
+                refresh_rate = display_mode.refresh_rate;
+            }
+            std::this_thread::sleep_until(ui_frame_start +
+                                          std::chrono::microseconds(1000000 / refresh_rate));
+        }
+    }
+
+    if (render_thread) {
+        render_thread->quit = true;
+        ++render_thread->cancel_token->generation;
+        if (render_thread_handle.joinable()) {
+            render_thread_handle.join();
+        }
+    }
+}
+
+RenderThread::RenderThread(RenderBackend *renderer,
+                           const size_t benchmark_frames,
+                           const std::string &validation_img_prefix,
+                           const std::string &validation_img_ext,
+                           ImageWriter *image_writer)
+    : renderer(renderer),
+      cancel_token(std::make_shared<CancellationToken>()),
+      quit(false),
+      benchmark_frames(benchmark_frames),
+      validation_img_prefix(validation_img_prefix),
+      validation_img_ext(validation_img_ext),
+      image_writer(image_writer)
+{
+    renderer->cancel_token = cancel_token;
+}
+
+void RenderThread::run(glm::uvec2 fb_dims)
+{
+    RenderParams current;
+    uint64_t version = 0;
+    size_t frame_id = 0;
+    float render_time = 0.f;
+    float rays_per_second = 0.f;
+    uint64_t sequence = 0;
+    bool benchmark_done = false;
+    bool converged = false;
+    while (!quit) {
+        if (params.update()) {
+            current = params.front_buffer();
+            if (current.fb_dims != fb_dims) {
+                fb_dims = current.fb_dims;
+                renderer->initialize(fb_dims.x, fb_dims.y);
+                frame_id = 0;
+                converged = false;
+                resumed = false;
+            }
+            if (current.version != version) {
+                // Only the first params are for the camera a restored image was rendered with
+                resumed = resumed && version == 0;
+                version = current.version;
+                renderer->frame_generation = version;
+                frame_id = 0;
+                converged = false;
+            }
+        }
+
+        // A new density map continues refining the image, concentrated on the new region
+        if (sample_density.update()) {
+            std::swap(renderer->sample_density, sample_density.front_buffer());
+            converged = false;
+        }
+
+        // Once the benchmark is complete or the image has converged we keep the final frame
+        // around for the UI
+        if (benchmark_done || converged) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        const bool camera_changed = frame_id == 0 && !resumed;
+        renderer->integrator = camera_changed ? preview_integrator : Integrator::PATH_TRACER;
+        const RenderStats stats = renderer->render(
+            current.eye, current.dir, current.up, current.fov_y, camera_changed, true);
+        // Cancelled frames are discarded, the next will pick up the new params
+        if (stats.cancelled) {
+            frame_id = 0;
+            continue;
+        }
+
+        ++frame_id;
+        if (frame_id == 1) {
+            render_time = stats.render_time;
+            rays_per_second = stats.rays_per_second;
+        } else {
+            render_time += stats.render_time;
+            rays_per_second += stats.rays_per_second;
+        }
+
+        if (!validation_img_prefix.empty()) {
+            const std::string img_name = validation_img_prefix + "-f" +
+                                         std::to_string(frame_id) + "." + validation_img_ext;
+            image_writer->write(img_name, fb_dims, renderer->img.data());
+        }
+
+        converged = stats.converged;
+        if (benchmark_frames > 0 && (frame_id == benchmark_frames || converged)) {
+            benchmark_done = true;
+        }
+
+        RenderedFrame &frame = frames.back_buffer();
+        frame.img = renderer->img;
+        frame.dirty_regions = renderer->dirty_regions;
+        frame.full_image_dirty = renderer->full_image_dirty;
+        frame.fb_dims = fb_dims;
+        frame.stats = stats;
+        frame.frame_id = frame_id;
+        frame.render_time = render_time;
+        frame.rays_per_second = rays_per_second;
+        frame.sequence = ++sequence;
+        frame.benchmark_done = benchmark_done;
+        frames.publish();
+
+        if (checkpoint_writer) {
+            checkpoint_accumulation(renderer,
+                                    checkpoint_writer,
+                                    *checkpoint_state,
+                                    current.eye,
+                                    current.dir,
+                                    current.up,
+                                    current.fov_y,
+                                    scene_hash);
+        }
+    }
+}
+
+void checkpoint_accumulation(RenderBackend *renderer,
+                             CheckpointWriter *writer,
+                             AccumulationState &state,
+                             const glm::vec3 &eye,
+                             const glm::vec3 &dir,
+                             const glm::vec3 &up,
+                             const float fov_y,
+                             const uint64_t scene_hash)
+{
+    if (!writer->ready() || !renderer->save_accumulation(state) || state.frame_id == 0) {
+        return;
+    }
+    state.camera_hash = hash_camera(eye, dir, up, fov_y);
+    state.scene_hash = scene_hash;
+    writer->write(state);
+}
+
+bool read_camera_file(const std::string &fname, std::vector<Camera> &cameras)
+{
+    std::ifstream fin(fname.c_str());
+    if (!fin) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(fin, line)) {
+        std::stringstream ss(line);
+        Camera camera;
+        camera.position = glm::vec3(0, 0, 5);
+        camera.center = glm::vec3(0);
+        camera.up = glm::vec3(0, 1, 0);
+        camera.fov_y = 65.f;
+        bool got_camera = false;
+        std::string arg;
+        while (ss >> arg) {
+            if (arg == "-eye") {
+                ss >> camera.position.x >> camera.position.y >> camera.position.z;
+            } else if (arg == "-center") {
+                ss >> camera.center.x >> camera.center.y >> camera.center.z;
+            } else if (arg == "-up") {
+                ss >> camera.up.x >> camera.up.y >> camera.up.z;
+            } else if (arg == "-fov") {
+                ss >> camera.fov_y;
+            } else {
+                // Skip comments and anything else which isn't a camera parameter
+                break;
+            }
+            if (!ss) {
+                return false;
+            }
+            got_camera = true;
+        }
+        if (got_camera) {
+            cameras.push_back(camera);
+        }
+    }
+    return true;
+}
+
+void run_batch(RenderBackend *renderer,
+               const std::vector<Camera> &cameras,
+               const glm::uvec2 &fb_dims,
+               const std::string &prefix,
+               const uint32_t frames,
+               const bool interleave)
+{
+    using namespace std::chrono;
+    std::cout << "Rendering " << cameras.size() << " views at " << fb_dims.x << "x"
+              << fb_dims.y << ", " << frames << " frames each\n";
+
+    ImageWriter image_writer;
+    const auto start = steady_clock::now();
+    if (interleave) {
+        // The views are written as they complete while the rest are still rendering
+        std::mutex output_mutex;
+        auto view_done = [&](const size_t view_id, const uint32_t *img, const float time) {
+            const std::string img_name = prefix + std::to_string(view_id) + ".png";
+            image_writer.write(img_name, fb_dims, img);
+
+            const float elapsed =
+                duration_cast<milliseconds>(steady_clock::now() - start).count() * 1.0e-3f;
+            std::lock_guard<std::mutex> lock(output_mutex);
+            std::cout << "View " << view_id << ": " << time << "ms render time, done at "
+                      << elapsed << "s, wrote " << img_name << "\n";
+        };
+        const bool supported = renderer->render_batch(cameras, fb_dims, frames, view_done);
+        if (!supported) {
+            std::cout << "Error: The " << renderer->name()
+                      << " backend does not support -batch-interleave\n";
+            std::exit(1);
+        }
+    } else {
+        for (size_t i = 0; i < cameras.size(); ++i) {
+            const Camera &c = cameras[i];
+            ArcballCamera camera(c.position, c.center, c.up);
+            float view_time = 0.f;
+            for (uint32_t f = 0; f < frames; ++f) {
+                const RenderStats stats = renderer->render(
+                    camera.eye(), camera.dir(), camera.up(), c.fov_y, f == 0, f + 1 == frames);
+                view_time += stats.render_time;
+            }
+
+            const std::string img_name = prefix + std::to_string(i) + ".png";
+            image_writer.write(img_name, fb_dims, renderer->img.data());
+            std::cout << "View " << i << ": " << view_time << "ms render time, wrote "
+                      << img_name << "\n";
+        }
     }
+    image_writer.flush();
+
+    const float elapsed = duration_cast<milliseconds>(steady_clock::now() - start).count();
+    std::cout << "Batch of " << cameras.size() << " views done in " << elapsed * 1.0e-3f
+              << "s\n";
 }
@@ -0,0 +1,194 @@
+#include "checkpoint.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include "file_mapping.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char MAGIC[8] = {'C', 'R', 'T', 'C', 'K', 'P', 'T', '\0'};
+const uint32_t VERSION = 1;
+
+// The accumulation data starts on its own page after the header
+const size_t DATA_OFFSET = 4096;
+
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t accumulation_format;
+    uint32_t fb_width;
+    uint32_t fb_height;
+    uint32_t frame_id;
+    uint32_t padding;
+    uint64_t camera_hash;
+    uint64_t scene_hash;
+    uint64_t data_size;
+};
+
+bool write_checkpoint(const std::string &fname, const AccumulationState &state)
+{
+    CheckpointHeader header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.accumulation_format = state.accumulation_format;
+    header.fb_width = state.fb_dims.x;
+    header.fb_height = state.fb_dims.y;
+    header.frame_id = state.frame_id;
+    header.camera_hash = state.camera_hash;
+    header.scene_hash = state.scene_hash;
+    header.data_size = state.data.size();
+
+    std::vector<uint8_t> header_page(DATA_OFFSET, 0);
+    std::memcpy(header_page.data(), &header, sizeof(header));
+
+    const std::string tmp_fname = fname + ".tmp";
+    FILE *f = std::fopen(tmp_fname.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    bool success = std::fwrite(header_page.data(), 1, header_page.size(), f) ==
+                       header_page.size() &&
+                   std::fwrite(state.data.data(), 1, state.data.size(), f) ==
+                       state.data.size() &&
+                   std::fflush(f) == 0;
+    // Make sure the data is on disk before the rename makes it the current checkpoint
+#ifdef _WIN32
+    success = success && _commit(_fileno(f)) == 0;
+#else
+    success = success && fsync(fileno(f)) == 0;
+#endif
+    success = std::fclose(f) == 0 && success;
+    if (!success) {
+        std::remove(tmp_fname.c_str());
+        return false;
+    }
+
+#ifdef _WIN32
+    return MoveFileEx(tmp_fname.c_str(), fname.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return std::rename(tmp_fname.c_str(), fname.c_str()) == 0;
+#endif
+}
+
+}
+
+uint64_t hash_bytes(const void *bytes, const size_t size, uint64_t h)
+{
+    const uint8_t *b = reinterpret_cast<const uint8_t *>(bytes);
+    for (size_t i = 0; i < size; ++i) {
+        h ^= b[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+uint64_t hash_camera(const glm::vec3 &eye,
+                     const glm::vec3 &dir,
+                     const glm::vec3 &up,
+                     const float fov_y)
+{
+    const float params[10] = {
+        eye.x, eye.y, eye.z, dir.x, dir.y, dir.z, up.x, up.y, up.z, fov_y};
+    return hash_bytes(params, sizeof(params));
+}
+
+bool read_checkpoint(const std::string &fname, AccumulationState &state)
+{
+    // Check the file exists first to avoid the mapping reporting an error for it, as it's
+    // expected there won't be a checkpoint when first starting a render
+    if (!std::ifstream(fname.c_str())) {
+        return false;
+    }
+    try {
+        FileMapping mapping(fname);
+        CheckpointHeader header;
+        if (mapping.nbytes() < DATA_OFFSET) {
+            return false;
+        }
+        std::memcpy(&header, mapping.data(), sizeof(header));
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+            header.version != VERSION || mapping.nbytes() != DATA_OFFSET + header.data_size) {
+            return false;
+        }
+
+        state.fb_dims = glm::uvec2(header.fb_width, header.fb_height);
+        state.accumulation_format = header.accumulation_format;
+        state.frame_id = header.frame_id;
+        state.camera_hash = header.camera_hash;
+        state.scene_hash = header.scene_hash;
+        state.data.assign(mapping.data() + DATA_OFFSET,
+                          mapping.data() + DATA_OFFSET + header.data_size);
+    } catch (const std::runtime_error &) {
+        return false;
+    }
+    return true;
+}
+
+CheckpointWriter::CheckpointWriter(const std::string &fname, const float interval_seconds)
+    : fname(fname),
+      interval(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<float>(interval_seconds))),
+      last_checkpoint(std::chrono::steady_clock::now()),
+      thread(&CheckpointWriter::writer_thread, this)
+{
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        job_finished.wait(lock, [&]() { return !job_pending; });
+        quit = true;
+    }
+    job_available.notify_all();
+    thread.join();
+}
+
+bool CheckpointWriter::ready()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return !job_pending && std::chrono::steady_clock::now() - last_checkpoint >= interval;
+}
+
+void CheckpointWriter::write(AccumulationState &state)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        job_finished.wait(lock, [&]() { return !job_pending; });
+        std::swap(job, state);
+        job_pending = true;
+        last_checkpoint = std::chrono::steady_clock::now();
+    }
+    job_available.notify_one();
+}
+
+void CheckpointWriter::writer_thread()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        job_available.wait(lock, [&]() { return quit || job_pending; });
+        if (!job_pending) {
+            return;
+        }
+
+        // The job isn't touched by write() while it's pending, so we can write it out
+        // without holding the lock
+        lock.unlock();
+        if (!write_checkpoint(fname, job)) {
+            std::cerr << "Error: Failed to write checkpoint " << fname << "\n";
+        }
+        lock.lock();
+
+        job_pending = false;
+        job_finished.notify_all();
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+
+// A snapshot of a renderer's accumulated image, which can be restored to continue
+// accumulating from where it left off
+struct AccumulationState {
+    glm::uvec2 fb_dims = glm::uvec2(0);
+    uint32_t accumulation_format = 0;
+    // The number of sample passes accumulated, which is also the frame index the renderer's
+    // RNG sequence continues from
+    uint32_t frame_id = 0;
+    // Hashes of the camera and scene the image was accumulated for, set by the caller
+    uint64_t camera_hash = 0;
+    uint64_t scene_hash = 0;
+    // The backend specific accumulation buffer contents
+    std::vector<uint8_t> data;
+};
+
+// FNV-1a hash of the bytes, chained on to the hash h
+uint64_t hash_bytes(const void *bytes, const size_t size, uint64_t h = 0xcbf29ce484222325ULL);
+
+uint64_t hash_camera(const glm::vec3 &eye,
+                     const glm::vec3 &dir,
+                     const glm::vec3 &up,
+                     const float fov_y);
+
+/* Checkpoint files start with a fixed size header, followed by the accumulation data at
+ * a page aligned offset so the file can be mapped and used or copied directly.
+ * Returns false if the file doesn't exist or isn't a valid checkpoint
+ */
+bool read_checkpoint(const std::string &fname, AccumulationState &state);
+
+/* Writes checkpoints of long renders on a background thread so saving them doesn't stall
+ * rendering. Each checkpoint is written to a temporary file which then replaces the
+ * previous one, so a process killed part way through a write leaves the last complete
+ * checkpoint on disk. Checkpoints are taken at most once per interval and only once the
+ * previous one has finished writing.
+ */
+class CheckpointWriter {
+    std::string fname;
+    std::chrono::steady_clock::duration interval;
+    std::chrono::steady_clock::time_point last_checkpoint;
+
+    std::mutex mutex;
+    std::condition_variable job_available;
+    std::condition_variable job_finished;
+    AccumulationState job;
+    bool job_pending = false;
+    bool quit = false;
+    std::thread thread;
+
+public:
+    CheckpointWriter(const std::string &fname, const float interval_seconds);
+
+    // Waits for a pending checkpoint to be written
+    ~CheckpointWriter();
+
+    CheckpointWriter(const CheckpointWriter &) = delete;
+    CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+
+    // Check if it's time for a new checkpoint and the writer is free to take it
+    bool ready();
+
+    // Queue the state to be written, blocking if the previous checkpoint is still being
+    // written. The state is swapped with the writer's previous one, so its buffer can be
+    // reused for the next checkpoint without reallocating
+    void write(AccumulationState &state);
+
+private:
+    void writer_thread();
+};
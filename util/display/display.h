@@ -16,4 +16,8 @@ struct Display {
     virtual void new_frame() = 0;
 
     virtual void display(RenderBackend *renderer) = 0;
+
+    // Returns true if display() reads the renderer's img to show it, false if it shows
+    // the renderer's native render target directly
+    virtual bool needs_readback(RenderBackend *renderer) = 0;
 };
@@ -1,4 +1,5 @@
 #include "gldisplay.h"
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 #include <string>
@@ -35,6 +36,9 @@ void main(void){
 GLDisplay::GLDisplay(SDL_Window *win)
     : window(win), gl_context(SDL_GL_CreateContext(win)), render_texture(-1)
 {
+    upload_pbos.fill(0);
+    upload_fences.fill(0);
+
     SDL_GL_SetSwapInterval(0);
     SDL_GL_MakeCurrent(window, gl_context);
 
@@ -49,6 +53,8 @@ GLDisplay::GLDisplay(SDL_Window *win)
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
 
+    glGenBuffers(upload_pbos.size(), upload_pbos.data());
+
     glClearColor(0.0, 0.0, 0.0, 0.0);
     glDisable(GL_DEPTH_TEST);
 }
@@ -56,6 +62,12 @@ GLDisplay::GLDisplay(SDL_Window *win)
 GLDisplay::~GLDisplay()
 {
     glDeleteVertexArrays(1, &vao);
+    for (auto &f : upload_fences) {
+        if (f) {
+            glDeleteSync(f);
+        }
+    }
+    glDeleteBuffers(upload_pbos.size(), upload_pbos.data());
     if (render_texture != -1) {
         glDeleteTextures(1, &render_texture);
     }
@@ -95,6 +107,24 @@ void GLDisplay::resize(const int fb_width, const int fb_height)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // Any in flight uploads are from the old image size, wait on them before we orphan the
+    // buffers
+    for (size_t i = 0; i < upload_pbos.size(); ++i) {
+        if (upload_fences[i]) {
+            glClientWaitSync(upload_fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync(upload_fences[i]);
+            upload_fences[i] = 0;
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload_pbos[i]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER,
+                     sizeof(uint32_t) * fb_dims.x * fb_dims.y,
+                     nullptr,
+                     GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    upload_index = 0;
+    upload_full_image = true;
 }
 
 void GLDisplay::new_frame()
@@ -108,22 +138,17 @@ void GLDisplay::display(RenderBackend *renderer)
     if (gl_native) {
         display_native(gl_native->gl_display_texture);
     } else {
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, render_texture);
-        glTexSubImage2D(GL_TEXTURE_2D,
-                        0,
-                        0,
-                        0,
-                        fb_dims.x,
-                        fb_dims.y,
-                        GL_RGBA,
-                        GL_UNSIGNED_BYTE,
-                        renderer->img.data());
-
+        upload_image(
+            renderer->img.data(), renderer->full_image_dirty, renderer->dirty_regions);
         display_native(render_texture);
     }
 }
 
+bool GLDisplay::needs_readback(RenderBackend *renderer)
+{
+    return dynamic_cast<GLNativeRenderer *>(renderer) == nullptr;
+}
+
 void GLDisplay::display_native(const GLuint img)
 {
     glViewport(0, 0, fb_dims.x, fb_dims.y);
@@ -137,3 +162,83 @@ void GLDisplay::display_native(const GLuint img)
 
     SDL_GL_SwapWindow(window);
 }
+
+void GLDisplay::upload_image(const uint32_t *img,
+                             const bool full_image_dirty,
+                             const std::vector<glm::uvec4> &dirty_regions)
+{
+    std::vector<glm::uvec4> regions;
+    if (!upload_full_image && !full_image_dirty) {
+        // Nothing changed since the last upload, so the texture is already up to date
+        if (dirty_regions.empty()) {
+            return;
+        }
+        size_t dirty_pixels = 0;
+        for (const auto &r : dirty_regions) {
+            dirty_pixels += r.z * r.w;
+        }
+        // If the whole image changed it's faster to do a single upload than one per-region
+        if (dirty_pixels < size_t(fb_dims.x) * fb_dims.y) {
+            regions = dirty_regions;
+        }
+    }
+    if (regions.empty()) {
+        regions.push_back(glm::uvec4(0, 0, fb_dims.x, fb_dims.y));
+    }
+    upload_full_image = false;
+
+    GLsync &fence = upload_fences[upload_index];
+    if (fence) {
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(fence);
+        fence = 0;
+    }
+
+    // The staging buffer mirrors the image layout, so each region is copied to and uploaded
+    // from the same offset it has in the image
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload_pbos[upload_index]);
+    uint32_t *staging = static_cast<uint32_t *>(
+        glMapBufferRange(GL_PIXEL_UNPACK_BUFFER,
+                         0,
+                         sizeof(uint32_t) * fb_dims.x * fb_dims.y,
+                         GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+    if (!staging) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        throw std::runtime_error("Failed to map upload PBO");
+    }
+    for (const auto &r : regions) {
+        if (r.z == fb_dims.x) {
+            std::memcpy(staging + r.y * fb_dims.x,
+                        img + r.y * fb_dims.x,
+                        sizeof(uint32_t) * r.z * r.w);
+            continue;
+        }
+        for (uint32_t y = r.y; y < r.y + r.w; ++y) {
+            std::memcpy(staging + y * fb_dims.x + r.x,
+                        img + y * fb_dims.x + r.x,
+                        sizeof(uint32_t) * r.z);
+        }
+    }
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, render_texture);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, fb_dims.x);
+    for (const auto &r : regions) {
+        const size_t offset = sizeof(uint32_t) * (size_t(r.y) * fb_dims.x + r.x);
+        glTexSubImage2D(GL_TEXTURE_2D,
+                        0,
+                        r.x,
+                        r.y,
+                        r.z,
+                        r.w,
+                        GL_RGBA,
+                        GL_UNSIGNED_BYTE,
+                        reinterpret_cast<const void *>(offset));
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    upload_index = (upload_index + 1) % upload_pbos.size();
+}
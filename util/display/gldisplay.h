@@ -1,6 +1,8 @@
 #pragma once
 
+#include <array>
 #include <memory>
+#include <vector>
 #include <SDL.h>
 #include "display.h"
 #include "glad/glad.h"
@@ -15,6 +17,15 @@ struct GLDisplay : Display {
     std::unique_ptr<Shader> display_render;
     glm::uvec2 fb_dims;
 
+    // Pixel unpack buffers the image is staged through so the texture upload is done
+    // asynchronously by the driver. We cycle through them, waiting on each one's fence
+    // before writing to it again so we don't stall on a buffer the GPU is still reading.
+    std::array<GLuint, 3> upload_pbos;
+    std::array<GLsync, 3> upload_fences;
+    size_t upload_index = 0;
+    // Set after a resize, when the texture contents are undefined and must be fully uploaded
+    bool upload_full_image = true;
+
     GLDisplay(SDL_Window *window);
 
     ~GLDisplay() override;
@@ -29,7 +40,15 @@ struct GLDisplay : Display {
 
     void display(RenderBackend *renderer) override;
 
+    bool needs_readback(RenderBackend *renderer) override;
+
     void display_native(const GLuint img);
+
+    // Upload the dirty regions of the image to the render texture, or the entire image if
+    // full_image_dirty is set. An empty list of regions skips the upload
+    void upload_image(const uint32_t *img,
+                      const bool full_image_dirty,
+                      const std::vector<glm::uvec4> &dirty_regions);
 };
 
 struct GLNativeRenderer : RenderBackend {
@@ -0,0 +1,132 @@
+#include "image_writer.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include "stb_image_write.h"
+#include "util.h"
+
+namespace {
+
+bool write_ppm(const std::string &fname, const glm::uvec2 &dims, const uint32_t *img)
+{
+    std::ofstream fout(fname.c_str(), std::ios::binary);
+    if (!fout) {
+        return false;
+    }
+    fout << "P6\n" << dims.x << " " << dims.y << "\n255\n";
+
+    // PPM has no alpha channel, so strip it a row at a time
+    std::vector<uint8_t> row(dims.x * 3);
+    const uint8_t *pixels = reinterpret_cast<const uint8_t *>(img);
+    for (uint32_t y = 0; y < dims.y; ++y) {
+        const uint8_t *in_row = pixels + y * dims.x * 4;
+        for (uint32_t x = 0; x < dims.x; ++x) {
+            row[x * 3] = in_row[x * 4];
+            row[x * 3 + 1] = in_row[x * 4 + 1];
+            row[x * 3 + 2] = in_row[x * 4 + 2];
+        }
+        fout.write(reinterpret_cast<const char *>(row.data()), row.size());
+    }
+    return static_cast<bool>(fout);
+}
+
+}
+
+void write_image(const std::string &fname, const glm::uvec2 &dims, const uint32_t *img)
+{
+    std::string ext = get_file_extension(fname);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+    bool success = false;
+    if (ext == "ppm") {
+        success = write_ppm(fname, dims, img);
+    } else {
+        success = stbi_write_png(fname.c_str(), dims.x, dims.y, 4, img, 4 * dims.x) != 0;
+    }
+
+    if (!success) {
+        std::cerr << "Error: Failed to write image " << fname << "\n";
+    }
+}
+
+ImageWriter::ImageWriter(const size_t num_threads, const size_t max_queued)
+    : max_queued(std::max(max_queued, size_t(1)))
+{
+    for (size_t i = 0; i < std::max(num_threads, size_t(1)); ++i) {
+        threads.emplace_back(&ImageWriter::writer_thread, this);
+    }
+}
+
+ImageWriter::~ImageWriter()
+{
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    job_available.notify_all();
+    for (auto &t : threads) {
+        t.join();
+    }
+}
+
+void ImageWriter::write(const std::string &fname, const glm::uvec2 &dims, const uint32_t *img)
+{
+    const size_t num_pixels = size_t(dims.x) * dims.y;
+
+    std::vector<uint32_t> buf;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        job_finished.wait(lock, [&]() { return jobs.size() + jobs_reserved < max_queued; });
+        ++jobs_reserved;
+        if (!buffer_pool.empty()) {
+            buf = std::move(buffer_pool.back());
+            buffer_pool.pop_back();
+        }
+    }
+
+    // Copy outside the lock so the writer threads can keep picking up jobs
+    buf.resize(num_pixels);
+    std::copy(img, img + num_pixels, buf.begin());
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        --jobs_reserved;
+        jobs.push_back(Job{fname, dims, std::move(buf)});
+    }
+    job_available.notify_one();
+}
+
+void ImageWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    job_finished.wait(
+        lock, [&]() { return jobs.empty() && jobs_reserved == 0 && jobs_in_progress == 0; });
+}
+
+void ImageWriter::writer_thread()
+{
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job_available.wait(lock, [&]() { return quit || !jobs.empty(); });
+            if (jobs.empty()) {
+                return;
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+            ++jobs_in_progress;
+        }
+
+        write_image(job.fname, job.dims, job.img.data());
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --jobs_in_progress;
+            buffer_pool.push_back(std::move(job.img));
+        }
+        job_finished.notify_all();
+    }
+}
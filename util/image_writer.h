@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+
+/* Writes RGBA8 images out on background threads, so encoding them doesn't stall
+ * rendering. Images are copied into buffers from a pool which are recycled once written.
+ * If more than max_queued images are waiting to be written, write() blocks until
+ * the writer threads catch up, bounding the memory used by the queue.
+ * The format is picked from the file extension: .png, or .ppm for fast uncompressed
+ * output (the alpha channel is dropped) when dumping images at a high rate.
+ */
+class ImageWriter {
+    struct Job {
+        std::string fname;
+        glm::uvec2 dims;
+        std::vector<uint32_t> img;
+    };
+
+    std::mutex mutex;
+    // Signalled when a job is added to the queue or the writer is shutting down
+    std::condition_variable job_available;
+    // Signalled when a job is finished, making space in the queue
+    std::condition_variable job_finished;
+    std::deque<Job> jobs;
+    std::vector<std::vector<uint32_t>> buffer_pool;
+    size_t max_queued;
+    // Queue slots claimed by write() calls which are still copying their image, so
+    // concurrent writers can't overshoot max_queued between the check and the push
+    size_t jobs_reserved = 0;
+    size_t jobs_in_progress = 0;
+    bool quit = false;
+    std::vector<std::thread> threads;
+
+public:
+    ImageWriter(const size_t num_threads = 2, const size_t max_queued = 8);
+
+    // Waits for any queued images to be written
+    ~ImageWriter();
+
+    ImageWriter(const ImageWriter &) = delete;
+    ImageWriter &operator=(const ImageWriter &) = delete;
+
+    // Copy the image and queue it to be written, blocking if the queue is full
+    void write(const std::string &fname, const glm::uvec2 &dims, const uint32_t *img);
+
+    // Wait for all queued images to be written
+    void flush();
+
+private:
+    void writer_thread();
+};
+
+// Write the image immediately on the calling thread
+void write_image(const std::string &fname, const glm::uvec2 &dims, const uint32_t *img);
@@ -1,4 +1,5 @@
 #include "material.h"
+#include <algorithm>
 #include <stdexcept>
 #include "stb_image.h"
 
@@ -6,8 +7,7 @@ Image::Image(const std::string &file, const std::string &name, ColorSpace color_
     : name(name), color_space(color_space)
 {
     stbi_set_flip_vertically_on_load(1);
-    uint8_t *data = stbi_load(file.c_str(), &width, &height, &channels, 4);
-    channels = 4;
+    uint8_t *data = stbi_load(file.c_str(), &width, &height, &channels, 0);
     if (!data) {
         throw std::runtime_error("Failed to load " + file);
     }
@@ -31,3 +31,81 @@ Image::Image(const uint8_t *buf,
 {
 }
 
+const uint8_t *rgba8_pixels(const Image &img, std::vector<uint8_t> &scratch)
+{
+    if (img.channels == 4) {
+        return img.img.data();
+    }
+
+    const size_t num_pixels = size_t(img.width) * img.height;
+    scratch.resize(num_pixels * 4);
+    for (size_t i = 0; i < num_pixels; ++i) {
+        const uint8_t *in = &img.img[i * img.channels];
+        uint8_t *out = &scratch[i * 4];
+        if (img.channels <= 2) {
+            out[0] = in[0];
+            out[1] = in[0];
+            out[2] = in[0];
+            out[3] = img.channels == 2 ? in[1] : 255;
+        } else {
+            out[0] = in[0];
+            out[1] = in[1];
+            out[2] = in[2];
+            out[3] = 255;
+        }
+    }
+    return scratch.data();
+}
+
+int mip_level_count(const int width, const int height)
+{
+    int levels = 1;
+    for (int size = std::max(width, height); size > 1; size /= 2) {
+        ++levels;
+    }
+    return levels;
+}
+
+std::vector<Image> generate_mips(const Image &img)
+{
+    std::vector<Image> mips;
+    const int num_levels = mip_level_count(img.width, img.height);
+    if (num_levels > 1) {
+        mips.reserve(num_levels - 1);
+    }
+    const Image *prev = &img;
+    for (int l = 1; l < num_levels; ++l) {
+        Image level;
+        level.name = img.name;
+        level.width = std::max(prev->width / 2, 1);
+        level.height = std::max(prev->height / 2, 1);
+        level.channels = img.channels;
+        level.color_space = img.color_space;
+        level.img.resize(size_t(level.width) * level.height * level.channels);
+
+        // Average the 2x2 texels covering each texel in the level below, clamping to the
+        // edge for odd sized levels
+        for (int y = 0; y < level.height; ++y) {
+            const int y0 = std::min(y * 2, prev->height - 1);
+            const int y1 = std::min(y * 2 + 1, prev->height - 1);
+            for (int x = 0; x < level.width; ++x) {
+                const int x0 = std::min(x * 2, prev->width - 1);
+                const int x1 = std::min(x * 2 + 1, prev->width - 1);
+                const uint8_t *row0 = &prev->img[size_t(y0) * prev->width * img.channels];
+                const uint8_t *row1 = &prev->img[size_t(y1) * prev->width * img.channels];
+                const uint8_t *t00 = row0 + x0 * img.channels;
+                const uint8_t *t10 = row0 + x1 * img.channels;
+                const uint8_t *t01 = row1 + x0 * img.channels;
+                const uint8_t *t11 = row1 + x1 * img.channels;
+                for (int c = 0; c < level.channels; ++c) {
+                    const int sum = t00[c] + t10[c] + t01[c] + t11[c];
+                    level.img[(size_t(y) * level.width + x) * level.channels + c] =
+                        (sum + 2) / 4;
+                }
+            }
+        }
+        mips.push_back(std::move(level));
+        prev = &mips.back();
+    }
+    return mips;
+}
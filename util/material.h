@@ -8,6 +8,16 @@
 
 enum ColorSpace { LINEAR, SRGB };
 
+/* The layout of an image's data. Block compressed formats store 4x4 texel blocks in
+ * row-major order, with partial blocks at the right and bottom edges padded out by
+ * repeating the edge texels (see texture_compression.h)
+ */
+enum class TextureFormat { UNCOMPRESSED = 0, BC1 = 1, BC3 = 2, BC4 = 3, BC5 = 4 };
+
+/* Images are stored with the channel count they were loaded with. Single and two channel
+ * images are luminance and luminance + alpha, material texture channel selections
+ * (see texture_channel_mask.h) refer to the RGBA channels the image would expand to.
+ */
 struct Image {
     std::string name;
     int width = -1;
@@ -15,6 +25,7 @@ struct Image {
     int channels = -1;
     std::vector<uint8_t> img;
     ColorSpace color_space = LINEAR;
+    TextureFormat format = TextureFormat::UNCOMPRESSED;
 
     Image(const std::string &file, const std::string &name, ColorSpace color_space = LINEAR);
     Image(const uint8_t *buf,
@@ -26,6 +37,19 @@ struct Image {
     Image() = default;
 };
 
+// Get the image's pixels as RGBA8 for backends which only support four channel textures.
+// Returns the image's own data if it's already RGBA8, otherwise the pixels are expanded
+// into the scratch buffer
+const uint8_t *rgba8_pixels(const Image &img, std::vector<uint8_t> &scratch);
+
+// The number of levels in a full mip chain for an image, including the base level
+int mip_level_count(const int width, const int height);
+
+// Build the mip chain below the uncompressed image by repeatedly box filtering it down by
+// 2x, returning levels 1 to mip_level_count - 1. The image should be linear, since the
+// texels are averaged without decoding sRGB
+std::vector<Image> generate_mips(const Image &img);
+
 struct DisneyMaterial {
     glm::vec3 base_color = glm::vec3(0.9f);
     float metallic = 0.f;
@@ -1,13 +1,24 @@
 #include "mesh.h"
 #include <algorithm>
 #include <numeric>
+#include <utility>
+
+size_t Geometry::num_vertices() const
+{
+    return vertices.empty() ? 0 : vertices.size() - 1;
+}
 
 size_t Geometry::num_tris() const
 {
     return indices.size();
 }
 
-Mesh::Mesh(const std::vector<Geometry> &geometries) : geometries(geometries) {}
+void Geometry::pad_vertices()
+{
+    vertices.push_back(glm::vec3(0.f));
+}
+
+Mesh::Mesh(std::vector<Geometry> geometries) : geometries(std::move(geometries)) {}
 
 size_t Mesh::num_tris() const
 {
@@ -4,17 +4,25 @@
 #include <glm/glm.hpp>
 
 struct Geometry {
+    // The vertices end with an extra padding vertex which isn't referenced by the indices,
+    // as Embree reads vertices with 16 byte loads, so backends can share them directly.
+    // Use num_vertices for the number of real vertices
     std::vector<glm::vec3> vertices, normals;
     std::vector<glm::vec2> uvs;
     std::vector<glm::uvec3> indices;
 
+    size_t num_vertices() const;
+
     size_t num_tris() const;
+
+    // Append the padding vertex once the geometry's vertices are loaded
+    void pad_vertices();
 };
 
 struct Mesh {
     std::vector<Geometry> geometries;
 
-    Mesh(const std::vector<Geometry> &geometries);
+    Mesh(std::vector<Geometry> geometries);
 
     Mesh() = default;
 
@@ -1,26 +1,170 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <vector>
 #include "scene.h"
 #include <glm/glm.hpp>
 
+struct AccumulationState;
+class TiledImageFile;
+
 struct RenderStats {
     float render_time = 0;
     float rays_per_second = 0;
+    // The number of samples taken per-pixel in the frame, or 0 if not reported
+    uint32_t samples_per_pixel = 0;
+    // Estimated variance of the accumulated image, or a negative value if not reported
+    float variance = -1.f;
+    // Set if the variance has fallen below the variance threshold, further frames with the
+    // same camera will not noticeably improve the image
+    bool converged = false;
+    // Set if the frame was abandoned part way through because it became stale
+    bool cancelled = false;
+};
+
+enum class BVHQuality { LOW, MEDIUM, HIGH };
+
+// Called as each view of a batch render completes, with the view's index, its RGBA8 image
+// and the render time in milliseconds spent on it
+using BatchViewCallback = std::function<void(size_t, const uint32_t *, float)>;
+
+// Integrators to render frames with. Besides path tracing there are much cheaper previews for
+// framing shots while the camera moves: the first hit's albedo, ambient occlusion or direct
+// lighting only
+enum class Integrator {
+    PATH_TRACER = 0,
+    ALBEDO = 1,
+    AMBIENT_OCCLUSION = 2,
+    DIRECT_LIGHTING = 3
+};
+
+// Optional render settings on RenderBackend which only some backends honor, the others
+// ignore them
+enum class RenderFeature {
+    FRAME_TIME_BUDGET,
+    VARIANCE_THRESHOLD,
+    BVH_OPTIONS,
+    COMPRESSED_TEXTURES,
+    TEXTURE_MIPMAPS,
+    ACCUMULATION_FORMAT,
+    PRIMARY_HIT_CACHE,
+    TEMPORAL_REPROJECTION,
+    PREVIEW_INTEGRATORS,
+    VARIABLE_SAMPLE_DENSITY,
+    CHECKPOINT
+};
+
+// Storage formats for accumulated images, trading precision for memory use and bandwidth
+// on large framebuffers: 12, 6 or 4 bytes per pixel respectively
+enum class AccumulationFormat { FP32 = 0, FP16 = 1, RGB9E5 = 2 };
+
+/* Shared between the thread driving a renderer and the UI thread, which bumps the
+ * generation whenever it changes the camera or framebuffer. A frame started for an older
+ * generation is stale and backends which support cancellation may abandon it.
+ */
+struct CancellationToken {
+    std::atomic<uint64_t> generation;
+
+    CancellationToken() : generation(0) {}
 };
 
 struct RenderBackend {
     std::vector<uint32_t> img;
     uint32_t samples_per_pixel = 1;
+    // Target time for render() to take in milliseconds. Backends which support it take as
+    // many passes of samples_per_pixel samples as fit in the budget. 0 disables the budget
+    float frame_time_budget = 0.f;
+    // Target variance for the accumulated image. Backends which estimate variance focus
+    // sampling on unconverged regions and report when the image is converged. 0 disables it
+    float variance_threshold = 0.f;
+    // BVH build options for backends which expose them, trading build time and memory
+    // use against trace performance. Must be set before set_scene
+    BVHQuality bvh_quality = BVHQuality::MEDIUM;
+    // When building high quality BVHs, meshes with more triangles than this are built at
+    // medium quality to bound the build time. 0 builds all meshes at high quality
+    size_t bvh_high_quality_max_tris = 0;
+    bool bvh_compact = false;
+    bool bvh_robust = false;
+    // Block compress textures to reduce memory use, for backends which can sample
+    // compressed textures. Must be set before set_scene
+    bool compress_textures = false;
+    // Build mip chains for the textures and filter them trilinearly at the level of detail
+    // of the ray footprint, for backends which support it. Must be set before set_scene
+    bool texture_mipmaps = false;
+    // Format of the accumulation buffer for backends which support it. Must be set before
+    // initialize
+    AccumulationFormat accumulation_format = AccumulationFormat::FP32;
+    // The number of fixed subpixel jitter positions per pixel to cache the first hits of,
+    // for backends which support it. Once the camera stops moving the primary rays through
+    // these are traced and shaded once, and later frames start their paths from the cached
+    // hits. Antialiasing is then limited to these positions. 0 disables the cache. Must be
+    // set before initialize
+    uint32_t primary_hit_cache_jitters = 0;
+    // Reproject the accumulated image into the new view when the camera moves, for backends
+    // which support it, instead of starting again from scratch. Pixels whose first hit
+    // wasn't visible in the previous view are rejected, the others keep at most this many
+    // frames of history so their stale shading is replaced. While a preview integrator is
+    // used the last path traced image is kept, and reprojected once path tracing resumes.
+    // 0 disables reprojection. Must be set before initialize
+    uint32_t temporal_reprojection_frames = 0;
+    // Allow the number of samples taken to vary over the image through sample_density, for
+    // backends which support it. Must be set before initialize
+    bool variable_sample_density = false;
+    // Per-pixel sample density in [0, 1] over the framebuffer, row-major. Each frame takes
+    // density * samples_per_pixel samples in a pixel on average, rounded up or down at
+    // random, so with few samples per-pixel low density pixels skip frames. The frames are
+    // weighted by their sample counts when accumulating. Empty, or not matching the
+    // framebuffer size, to take samples_per_pixel samples everywhere. Can be changed
+    // between frames without restarting accumulation
+    std::vector<float> sample_density;
+    // The integrator to render frames with, for backends which support ones other than path
+    // tracing. It can be changed between frames, which restarts accumulation
+    Integrator integrator = Integrator::PATH_TRACER;
+    // The number of rays taken for each sample by the ambient occlusion integrator
+    uint32_t ao_samples = 4;
+    // Regions of img (x, y, width, height) written by the last call to render, an empty list
+    // means nothing in the image changed. Only used if full_image_dirty is false, backends
+    // which don't track this leave it set and the whole image is treated as changed
+    std::vector<glm::uvec4> dirty_regions;
+    bool full_image_dirty = true;
+    // Optional, if set the frame being rendered is stale once the token's generation no
+    // longer matches frame_generation
+    std::shared_ptr<CancellationToken> cancel_token;
+    uint64_t frame_generation = 0;
 
     virtual ~RenderBackend() {}
 
     virtual std::string name() = 0;
 
+    // Backends which only render into img, and don't share a graphics device or context with
+    // the display, can be driven from a render thread separate from the UI
+    virtual bool supports_render_thread()
+    {
+        return false;
+    }
+
+    // Check if the backend honors the optional render setting, so callers can reject
+    // settings it would silently ignore
+    virtual bool supports_feature(const RenderFeature)
+    {
+        return false;
+    }
+
     virtual void initialize(const int fb_width, const int fb_height) = 0;
 
-    // TODO Probably should take the scene through a shared_ptr
-    virtual void set_scene(const Scene &scene) = 0;
+    // Check if the frame being rendered has been made stale by a camera or framebuffer change
+    bool frame_cancelled() const
+    {
+        return cancel_token &&
+               cancel_token->generation.load(std::memory_order_relaxed) != frame_generation;
+    }
+
+    // Backends which render from the scene's data on the CPU keep a reference to the scene
+    // instead of copying it, so the caller can release its own reference once the scene
+    // has been set. The scene must not be modified after it's been set
+    virtual void set_scene(const std::shared_ptr<const Scene> &scene) = 0;
 
     // Returns the rays per-second achieved, or -1 if this is not tracked
     virtual RenderStats render(const glm::vec3 &pos,
@@ -29,4 +173,56 @@ struct RenderBackend {
                                const float fovy,
                                const bool camera_changed,
                                const bool readback_framebuffer) = 0;
+
+    // Bytes of texture data the backend holds in addition to the scene's textures, e.g.
+    // for converted copies or mip levels, or 0 if it isn't reported
+    virtual size_t texture_memory()
+    {
+        return 0;
+    }
+
+    // Render an image too large to hold in memory tile by tile with the camera (pos, dir,
+    // up, fovy), writing each finished tile to the file. Tiles already in the file are
+    // skipped, so an interrupted render can be resumed. Each pixel takes
+    // passes * samples_per_pixel samples. Returns false if the backend doesn't support this
+    virtual bool render_poster(TiledImageFile &,
+                               const glm::vec3 &,
+                               const glm::vec3 &,
+                               const glm::vec3 &,
+                               const float,
+                               const uint32_t)
+    {
+        return false;
+    }
+
+    // Render an image of the dimensions for each camera, with each pixel taking
+    // passes * samples_per_pixel samples. The views' tiles are interleaved so the worker
+    // threads are kept busy across the whole batch rather than waiting for the last tiles of
+    // each view. view_done is called from a worker thread once a view is complete, the image
+    // passed to it is only valid during the call. Returns false if the backend doesn't
+    // support this
+    virtual bool render_batch(const std::vector<Camera> &,
+                              const glm::uvec2 &,
+                              const uint32_t,
+                              const BatchViewCallback &)
+    {
+        return false;
+    }
+
+    // Copy the accumulated image into the state, so long renders can be checkpointed. Must
+    // be called between frames. Returns false if the backend doesn't support this, backends
+    // which do report RenderFeature::CHECKPOINT
+    virtual bool save_accumulation(AccumulationState &)
+    {
+        return false;
+    }
+
+    // Restore an accumulated image saved by save_accumulation. The next frame rendered
+    // without a camera change continues accumulating from it, taking the samples which
+    // follow those already accumulated. Returns false if the backend doesn't support this
+    // or the state doesn't match the framebuffer size and accumulation format
+    virtual bool restore_accumulation(const AccumulationState &)
+    {
+        return false;
+    }
 };
@@ -0,0 +1,89 @@
+#include "sample_density.h"
+#include <algorithm>
+#include "stb_image.h"
+
+namespace {
+
+// Weight of a pixel at the distance outside the region, 1 inside falling off smoothly to 0
+float falloff_weight(const float dist, const float falloff)
+{
+    if (dist <= 0.f) {
+        return 1.f;
+    }
+    const float x = glm::clamp(1.f - dist / std::max(falloff, 1.f), 0.f, 1.f);
+    return x * x * (3.f - 2.f * x);
+}
+
+}
+
+bool SampleDensityRegion::load_mask(const std::string &fname)
+{
+    int width, height, channels;
+    uint8_t *data = stbi_load(fname.c_str(), &width, &height, &channels, 1);
+    if (!data) {
+        return false;
+    }
+    mask_dims = glm::uvec2(width, height);
+    mask.resize(size_t(width) * height);
+    std::transform(data, data + mask.size(), mask.begin(), [](const uint8_t x) {
+        return x / 255.f;
+    });
+    stbi_image_free(data);
+    return true;
+}
+
+bool SampleDensityRegion::active() const
+{
+    return (fovea_radius > 0.f && cursor.x >= 0.f) || (rect.z > 0.f && rect.w > 0.f) ||
+           !mask.empty();
+}
+
+void SampleDensityRegion::compute_density(const glm::uvec2 &fb_dims,
+                                          std::vector<float> &density) const
+{
+    density.clear();
+    if (!active()) {
+        return;
+    }
+
+    // Compute the weight of each pixel in the region, then map it to a density
+    density.resize(size_t(fb_dims.x) * fb_dims.y, 0.f);
+    if (!mask.empty()) {
+        for (uint32_t y = 0; y < fb_dims.y; ++y) {
+            const uint32_t mask_y = std::min(y * mask_dims.y / fb_dims.y, mask_dims.y - 1);
+            for (uint32_t x = 0; x < fb_dims.x; ++x) {
+                const uint32_t mask_x = std::min(x * mask_dims.x / fb_dims.x, mask_dims.x - 1);
+                density[y * fb_dims.x + x] = mask[mask_y * mask_dims.x + mask_x];
+            }
+        }
+    }
+
+    // Only the pixels within the falloff of the rectangle and circle need to be updated
+    auto update_bounds = [&](const glm::vec2 &lo, const glm::vec2 &hi, auto distance) {
+        const glm::ivec2 start = glm::max(glm::ivec2(lo - falloff), glm::ivec2(0));
+        const glm::ivec2 end = glm::min(glm::ivec2(hi + falloff) + 1, glm::ivec2(fb_dims));
+        for (int y = start.y; y < end.y; ++y) {
+            for (int x = start.x; x < end.x; ++x) {
+                float &w = density[y * fb_dims.x + x];
+                const glm::vec2 p = glm::vec2(x, y) + 0.5f;
+                w = std::max(w, falloff_weight(distance(p), falloff));
+            }
+        }
+    };
+    if (rect.z > 0.f && rect.w > 0.f) {
+        const glm::vec2 lo(rect.x, rect.y);
+        const glm::vec2 hi = lo + glm::vec2(rect.z, rect.w);
+        update_bounds(lo, hi, [&](const glm::vec2 &p) {
+            return glm::length(glm::max(glm::max(lo - p, p - hi), glm::vec2(0.f)));
+        });
+    }
+    if (fovea_radius > 0.f && cursor.x >= 0.f) {
+        update_bounds(cursor - fovea_radius, cursor + fovea_radius, [&](const glm::vec2 &p) {
+            return glm::length(p - cursor) - fovea_radius;
+        });
+    }
+
+    for (auto &d : density) {
+        d = min_density + (1.f - min_density) * d;
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+/* Describes the region of the image being inspected, for concentrating samples in it: a
+ * circle following the mouse cursor, a rectangle drawn by the user and an image mask can
+ * each mark the region. Pixels in the region have a sample density of 1, falling off
+ * smoothly to min_density outside it.
+ */
+struct SampleDensityRegion {
+    float min_density = 0.1f;
+    // Width in pixels of the falloff from the region to min_density
+    float falloff = 64.f;
+    // Radius in pixels of the circle around the cursor, 0 if it doesn't follow the cursor
+    float fovea_radius = 0.f;
+    glm::vec2 cursor = glm::vec2(-1.f);
+    // Rectangle (x, y, width, height) in pixels, unused if it has no area
+    glm::vec4 rect = glm::vec4(0.f);
+    // Grayscale mask stretched over the image, empty if not used
+    std::vector<float> mask;
+    glm::uvec2 mask_dims = glm::uvec2(0);
+
+    // Load the image as the mask, returns false if it can't be loaded
+    bool load_mask(const std::string &fname);
+
+    // Check if any part of the region is set, if not the image is sampled uniformly
+    bool active() const;
+
+    // Compute the sample density of each pixel in a framebuffer of the dimensions, the
+    // density is left empty if the region isn't active
+    void compute_density(const glm::uvec2 &fb_dims, std::vector<float> &density) const;
+};
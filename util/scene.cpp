@@ -64,6 +64,14 @@ Scene::Scene(const std::string &fname, MaterialMode material_mode)
         std::cout << "Unsupported file '" << fname << "'\n";
         throw std::runtime_error("Unsupported file " + fname);
     }
+
+    // The loaders reserve space for the padding vertex up front where they know the vertex
+    // count, so appending it doesn't reallocate
+    for (auto &m : meshes) {
+        for (auto &g : m.geometries) {
+            g.pad_vertices();
+        }
+    }
 }
 
 size_t Scene::unique_tris() const
@@ -177,9 +185,9 @@ void Scene::load_obj(const std::string &file)
             }
             geom.indices.push_back(tri_indices);
         }
-        mesh.geometries.push_back(geom);
+        mesh.geometries.push_back(std::move(geom));
     }
-    meshes.push_back(mesh);
+    meshes.push_back(std::move(mesh));
 
     // OBJ has a single "parameterized mesh" and "instance"
     parameterized_meshes.emplace_back(0, material_ids);
@@ -276,6 +284,7 @@ void Scene::load_gltf(const std::string &fname)
 
             // Note: assumes there is a POSITION (is this required by the gltf spec?)
             Accessor<glm::vec3> pos_accessor(model.accessors[p.attributes["POSITION"]], model);
+            geom.vertices.reserve(pos_accessor.size() + 1);
             for (size_t i = 0; i < pos_accessor.size(); ++i) {
                 geom.vertices.push_back(pos_accessor[i]);
             }
@@ -320,10 +329,10 @@ void Scene::load_gltf(const std::string &fname)
                 std::cout << "Unsupported index type\n";
                 throw std::runtime_error("Unsupported index component type");
             }
-            mesh.geometries.push_back(geom);
+            mesh.geometries.push_back(std::move(geom));
         }
         parameterized_meshes.emplace_back(meshes.size(), material_ids);
-        meshes.push_back(mesh);
+        meshes.push_back(std::move(mesh));
     }
 
     if (material_mode == MaterialMode::DEFAULT) {
@@ -440,7 +449,8 @@ void Scene::load_crts(const std::string &file)
                             v["byte_length"].get<uint64_t>(),
                             dtype_stride(dtype));
             Accessor<glm::vec3> accessor(view);
-            geom.vertices = std::vector<glm::vec3>(accessor.begin(), accessor.end());
+            geom.vertices.reserve(accessor.size() + 1);
+            geom.vertices.assign(accessor.begin(), accessor.end());
         }
         {
             const uint64_t view_id = m["indices"].get<uint64_t>();
@@ -476,8 +486,8 @@ void Scene::load_crts(const std::string &file)
 #endif
 
         Mesh mesh;
-        mesh.geometries.push_back(geom);
-        meshes.push_back(mesh);
+        mesh.geometries.push_back(std::move(geom));
+        meshes.push_back(std::move(mesh));
     }
 
     for (size_t i = 0; i < header["images"].size(); ++i) {
@@ -494,7 +504,7 @@ void Scene::load_crts(const std::string &file)
         stbi_set_flip_vertically_on_load(1);
         int x, y, n;
         uint8_t *img_data =
-            stbi_load_from_memory(accessor.begin(), accessor.size(), &x, &y, &n, 4);
+            stbi_load_from_memory(accessor.begin(), accessor.size(), &x, &y, &n, 0);
         stbi_set_flip_vertically_on_load(0);
         if (!img_data) {
             std::cout << "Failed to load " << img["name"].get<std::string>() << " from view\n";
@@ -506,7 +516,7 @@ void Scene::load_crts(const std::string &file)
             color_space = LINEAR;
         }
 
-        textures.emplace_back(img_data, x, y, 4, img["name"].get<std::string>(), color_space);
+        textures.emplace_back(img_data, x, y, n, img["name"].get<std::string>(), color_space);
         stbi_image_free(img_data);
     }
 
@@ -719,7 +729,7 @@ void Scene::load_pbrt(const std::string &file)
                     material_ids.push_back(material_id);
 
                     Geometry geom;
-                    geom.vertices.reserve(mesh->vertex.size());
+                    geom.vertices.reserve(mesh->vertex.size() + 1);
                     std::transform(
                         mesh->vertex.begin(),
                         mesh->vertex.end(),
@@ -739,7 +749,7 @@ void Scene::load_pbrt(const std::string &file)
                                    std::back_inserter(geom.uvs),
                                    [](const pbrt::vec2f &v) { return glm::vec2(v.x, v.y); });
 
-                    geometries.push_back(geom);
+                    geometries.push_back(std::move(geom));
                 } else if (pbrt::QuadMesh::SP mesh =
                                std::dynamic_pointer_cast<pbrt::QuadMesh>(g)) {
                     std::cout << "Encountered instanced quadmesh (unsupported type). Will "
@@ -761,7 +771,7 @@ void Scene::load_pbrt(const std::string &file)
                 continue;
             }
             const size_t mesh_id = meshes.size();
-            meshes.emplace_back(geometries);
+            meshes.emplace_back(std::move(geometries));
 
             parameterized_mesh_id = parameterized_meshes.size();
             parameterized_meshes.emplace_back(mesh_id, material_ids);
@@ -0,0 +1,263 @@
+#include "texture_compression.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+using Block = std::array<std::array<uint8_t, 4>, 16>;
+
+// Fetch the 4x4 block of texels at (bx, by) in blocks, repeating the edge texels to fill
+// out partial blocks
+Block fetch_block(const Image &img, const int bx, const int by)
+{
+    Block block;
+    for (int j = 0; j < 4; ++j) {
+        const int y = std::min(by * 4 + j, img.height - 1);
+        for (int i = 0; i < 4; ++i) {
+            const int x = std::min(bx * 4 + i, img.width - 1);
+            const uint8_t *texel = &img.img[(size_t(y) * img.width + x) * img.channels];
+            auto &out = block[j * 4 + i];
+            out = {0, 0, 0, 255};
+            std::copy(texel, texel + img.channels, out.begin());
+        }
+    }
+    return block;
+}
+
+uint16_t pack_565(const std::array<int, 3> &c)
+{
+    return ((c[0] * 31 + 127) / 255) << 11 | ((c[1] * 63 + 127) / 255) << 5 |
+           ((c[2] * 31 + 127) / 255);
+}
+
+std::array<int, 3> unpack_565(const uint16_t c)
+{
+    const int r = (c >> 11) & 0x1f;
+    const int g = (c >> 5) & 0x3f;
+    const int b = c & 0x1f;
+    return {(r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2)};
+}
+
+// Encode the RGB channels of the block to an 8 byte BC1 color block, always using the
+// four color mode so the block can also be used in BC3
+void encode_bc1_color(const Block &block, uint8_t *out)
+{
+    std::array<int, 3> lo = {255, 255, 255};
+    std::array<int, 3> hi = {0, 0, 0};
+    std::array<int, 3> mean = {0, 0, 0};
+    for (const auto &t : block) {
+        for (int c = 0; c < 3; ++c) {
+            lo[c] = std::min(lo[c], int(t[c]));
+            hi[c] = std::max(hi[c], int(t[c]));
+            mean[c] += t[c];
+        }
+    }
+
+    // Pick the bounding box diagonal which follows the colors in the block, by flipping
+    // the green and blue extents if they're anti-correlated with red
+    int cov_rg = 0;
+    int cov_rb = 0;
+    for (const auto &t : block) {
+        const int dr = t[0] * 16 - mean[0];
+        cov_rg += dr * (t[1] * 16 - mean[1]);
+        cov_rb += dr * (t[2] * 16 - mean[2]);
+    }
+    if (cov_rg < 0) {
+        std::swap(lo[1], hi[1]);
+    }
+    if (cov_rb < 0) {
+        std::swap(lo[2], hi[2]);
+    }
+
+    // Inset the endpoints slightly to reduce the error from outliers
+    for (int c = 0; c < 3; ++c) {
+        const int inset = (hi[c] - lo[c]) / 16;
+        hi[c] -= inset;
+        lo[c] += inset;
+    }
+
+    uint16_t c0 = pack_565(hi);
+    uint16_t c1 = pack_565(lo);
+    if (c0 < c1) {
+        std::swap(c0, c1);
+    }
+
+    uint32_t indices = 0;
+    if (c0 != c1) {
+        const auto e0 = unpack_565(c0);
+        const auto e1 = unpack_565(c1);
+        std::array<std::array<int, 3>, 4> palette;
+        for (int c = 0; c < 3; ++c) {
+            palette[0][c] = e0[c];
+            palette[1][c] = e1[c];
+            palette[2][c] = (2 * e0[c] + e1[c]) / 3;
+            palette[3][c] = (e0[c] + 2 * e1[c]) / 3;
+        }
+        for (int i = 0; i < 16; ++i) {
+            int best = 0;
+            int best_dist = std::numeric_limits<int>::max();
+            for (int p = 0; p < 4; ++p) {
+                int dist = 0;
+                for (int c = 0; c < 3; ++c) {
+                    const int d = int(block[i][c]) - palette[p][c];
+                    dist += d * d;
+                }
+                if (dist < best_dist) {
+                    best = p;
+                    best_dist = dist;
+                }
+            }
+            indices |= uint32_t(best) << (i * 2);
+        }
+    }
+
+    out[0] = c0 & 0xff;
+    out[1] = c0 >> 8;
+    out[2] = c1 & 0xff;
+    out[3] = c1 >> 8;
+    for (int i = 0; i < 4; ++i) {
+        out[4 + i] = (indices >> (i * 8)) & 0xff;
+    }
+}
+
+// Encode a single channel of the block to an 8 byte BC4 block, using the eight value mode
+void encode_bc4(const Block &block, const int channel, uint8_t *out)
+{
+    int lo = 255;
+    int hi = 0;
+    for (const auto &t : block) {
+        lo = std::min(lo, int(t[channel]));
+        hi = std::max(hi, int(t[channel]));
+    }
+
+    uint64_t indices = 0;
+    if (hi != lo) {
+        std::array<int, 8> palette;
+        palette[0] = hi;
+        palette[1] = lo;
+        for (int p = 2; p < 8; ++p) {
+            palette[p] = ((8 - p) * hi + (p - 1) * lo) / 7;
+        }
+        for (int i = 0; i < 16; ++i) {
+            int best = 0;
+            int best_dist = std::numeric_limits<int>::max();
+            for (int p = 0; p < 8; ++p) {
+                const int dist = std::abs(int(block[i][channel]) - palette[p]);
+                if (dist < best_dist) {
+                    best = p;
+                    best_dist = dist;
+                }
+            }
+            indices |= uint64_t(best) << (i * 3);
+        }
+    }
+
+    out[0] = hi;
+    out[1] = lo;
+    for (int i = 0; i < 6; ++i) {
+        out[2 + i] = (indices >> (i * 8)) & 0xff;
+    }
+}
+
+bool is_opaque(const Image &img)
+{
+    for (size_t i = 3; i < img.img.size(); i += 4) {
+        if (img.img[i] != 255) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+size_t texture_block_size(const TextureFormat format)
+{
+    switch (format) {
+    case TextureFormat::BC1:
+    case TextureFormat::BC4:
+        return 8;
+    case TextureFormat::BC3:
+    case TextureFormat::BC5:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+int texture_block_rows(const Image &img)
+{
+    return (img.height + 3) / 4;
+}
+
+Image compressed_texture_layout(const Image &img)
+{
+    if (img.format != TextureFormat::UNCOMPRESSED) {
+        throw std::runtime_error("compress_texture: " + img.name + " is already compressed");
+    }
+
+    Image out;
+    out.name = img.name;
+    out.width = img.width;
+    out.height = img.height;
+    out.channels = img.channels;
+    out.color_space = img.color_space;
+    if (img.channels == 1) {
+        out.format = TextureFormat::BC4;
+    } else if (img.channels == 2) {
+        out.format = TextureFormat::BC5;
+    } else if (img.channels == 3 || is_opaque(img)) {
+        out.format = TextureFormat::BC1;
+        out.channels = 3;
+    } else {
+        out.format = TextureFormat::BC3;
+    }
+
+    const size_t blocks_x = (img.width + 3) / 4;
+    out.img.resize(blocks_x * texture_block_rows(img) * texture_block_size(out.format));
+    return out;
+}
+
+void compress_texture_blocks(const Image &img,
+                             Image &out,
+                             const int block_row_begin,
+                             const int block_row_end)
+{
+    const int blocks_x = (img.width + 3) / 4;
+    const size_t block_size = texture_block_size(out.format);
+    for (int by = block_row_begin; by < block_row_end; ++by) {
+        for (int bx = 0; bx < blocks_x; ++bx) {
+            const Block block = fetch_block(img, bx, by);
+            uint8_t *b = &out.img[(size_t(by) * blocks_x + bx) * block_size];
+            switch (out.format) {
+            case TextureFormat::BC1:
+                encode_bc1_color(block, b);
+                break;
+            case TextureFormat::BC3:
+                encode_bc4(block, 3, b);
+                encode_bc1_color(block, b + 8);
+                break;
+            case TextureFormat::BC4:
+                encode_bc4(block, 0, b);
+                break;
+            case TextureFormat::BC5:
+                encode_bc4(block, 0, b);
+                encode_bc4(block, 1, b + 8);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+Image compress_texture(const Image &img)
+{
+    Image out = compressed_texture_layout(img);
+    compress_texture_blocks(img, out, 0, texture_block_rows(img));
+    return out;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include "material.h"
+
+/* Block compression of 8-bit textures to reduce their memory use, for backends which
+ * can sample compressed textures directly. The format is picked from the channel count:
+ * BC4 for luminance, BC5 for luminance + alpha, BC1 for RGB or opaque RGBA and BC3 for
+ * RGBA with a varying alpha channel. Texture compression is lossy, endpoints are picked
+ * by a fast fit to the block's bounding box so the quality is below offline encoders.
+ */
+
+// The size in bytes of a 4x4 texel block of the format
+size_t texture_block_size(const TextureFormat format);
+
+// The number of rows of 4x4 blocks in the compressed image
+int texture_block_rows(const Image &img);
+
+// Returns an image sized to hold the block compressed copy of the uncompressed image, with
+// its format picked but no blocks encoded. The copy keeps the image's channel count, except
+// opaque RGBA images which become RGB
+Image compressed_texture_layout(const Image &img);
+
+// Encode the block rows [block_row_begin, block_row_end) of the image into the compressed
+// image from compressed_texture_layout. Disjoint row ranges can be encoded in parallel
+void compress_texture_blocks(const Image &img,
+                             Image &out,
+                             const int block_row_begin,
+                             const int block_row_end);
+
+// Returns a block compressed copy of the uncompressed image
+Image compress_texture(const Image &img);
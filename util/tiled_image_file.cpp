@@ -0,0 +1,144 @@
+#include "tiled_image_file.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const char MAGIC[8] = {'C', 'R', 'T', 'T', 'I', 'L', 'E', 'S'};
+const uint32_t VERSION = 1;
+
+// Magic, version, width, height, tile width, tile height
+const size_t HEADER_SIZE = sizeof(MAGIC) + 5 * sizeof(uint32_t);
+
+}
+
+TiledImageFile::TiledImageFile(const std::string &fname,
+                               const glm::uvec2 &dims,
+                               const glm::uvec2 &tile_size)
+    : dims(dims), tile_size(tile_size), ntiles((dims + tile_size - glm::uvec2(1)) / tile_size)
+{
+    tile_done.resize(num_tiles(), 0);
+
+    // Try resuming an existing file for the same image
+    file.open(fname.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+    if (file) {
+        char magic[sizeof(MAGIC)] = {0};
+        uint32_t header[5] = {0};
+        file.read(magic, sizeof(magic));
+        file.read(reinterpret_cast<char *>(header), sizeof(header));
+        if (file && std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0 && header[0] == VERSION &&
+            header[1] == dims.x && header[2] == dims.y && header[3] == tile_size.x &&
+            header[4] == tile_size.y) {
+            file.read(reinterpret_cast<char *>(tile_done.data()), tile_done.size());
+            if (file) {
+                return;
+            }
+            std::fill(tile_done.begin(), tile_done.end(), 0);
+        }
+        file.close();
+    }
+
+    file.open(fname.c_str(),
+              std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("Failed to create tiled image file " + fname);
+    }
+    const uint32_t header[5] = {VERSION, dims.x, dims.y, tile_size.x, tile_size.y};
+    file.write(MAGIC, sizeof(MAGIC));
+    file.write(reinterpret_cast<const char *>(header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(tile_done.data()), tile_done.size());
+    file.flush();
+}
+
+const glm::uvec2 &TiledImageFile::dimensions() const
+{
+    return dims;
+}
+
+const glm::uvec2 &TiledImageFile::tile_dimensions() const
+{
+    return tile_size;
+}
+
+const glm::uvec2 &TiledImageFile::tile_count() const
+{
+    return ntiles;
+}
+
+size_t TiledImageFile::num_tiles() const
+{
+    return size_t(ntiles.x) * ntiles.y;
+}
+
+size_t TiledImageFile::tiles_remaining()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::count(tile_done.begin(), tile_done.end(), 0);
+}
+
+bool TiledImageFile::is_tile_done(const size_t tile_id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return tile_done[tile_id] != 0;
+}
+
+size_t TiledImageFile::tile_offset(const size_t tile_id) const
+{
+    return HEADER_SIZE + tile_done.size() + tile_id * tile_size.x * tile_size.y * 4;
+}
+
+void TiledImageFile::write_tile(const size_t tile_id, const uint32_t *pixels)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    file.seekp(tile_offset(tile_id));
+    file.write(reinterpret_cast<const char *>(pixels), size_t(tile_size.x) * tile_size.y * 4);
+    file.flush();
+
+    tile_done[tile_id] = 1;
+    file.seekp(HEADER_SIZE + tile_id);
+    file.write(reinterpret_cast<const char *>(&tile_done[tile_id]), 1);
+    file.flush();
+    if (!file) {
+        throw std::runtime_error("Failed to write tile to tiled image file");
+    }
+}
+
+bool TiledImageFile::write_ppm(const std::string &fname)
+{
+    if (tiles_remaining() != 0) {
+        return false;
+    }
+    std::ofstream fout(fname.c_str(), std::ios::binary);
+    if (!fout) {
+        return false;
+    }
+    fout << "P6\n" << dims.x << " " << dims.y << "\n255\n";
+
+    std::lock_guard<std::mutex> lock(mutex);
+    const size_t tile_pixels = size_t(tile_size.x) * tile_size.y;
+    std::vector<uint32_t> tile_row(tile_pixels * ntiles.x);
+    std::vector<uint8_t> row(size_t(dims.x) * 3);
+    for (uint32_t ty = 0; ty < ntiles.y; ++ty) {
+        // The tiles in a row are stored consecutively
+        file.seekg(tile_offset(size_t(ty) * ntiles.x));
+        file.read(reinterpret_cast<char *>(tile_row.data()), tile_row.size() * 4);
+        if (!file) {
+            return false;
+        }
+
+        const uint32_t rows = std::min(tile_size.y, dims.y - ty * tile_size.y);
+        for (uint32_t y = 0; y < rows; ++y) {
+            for (uint32_t x = 0; x < dims.x; ++x) {
+                const uint32_t tx = x / tile_size.x;
+                const uint32_t px = tile_row[tx * tile_pixels + y * tile_size.x +
+                                             x % tile_size.x];
+                row[x * 3] = px & 0xff;
+                row[x * 3 + 1] = (px >> 8) & 0xff;
+                row[x * 3 + 2] = (px >> 16) & 0xff;
+            }
+            fout.write(reinterpret_cast<const char *>(row.data()), row.size());
+        }
+    }
+    return static_cast<bool>(fout);
+}
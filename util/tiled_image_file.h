@@ -0,0 +1,55 @@
+#pragma once
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+/* An RGBA8 image stored on disk in fixed size tiles, for rendering images too large to
+ * hold in memory. The file starts with a header and a byte per tile recording if the tile
+ * has been written, followed by the tiles in row-major order. Tiles are written before
+ * being marked done, so reopening a partially written file resumes where it left off.
+ * Tiles can be written from multiple threads.
+ */
+class TiledImageFile {
+    std::fstream file;
+    std::mutex mutex;
+    glm::uvec2 dims;
+    glm::uvec2 tile_size;
+    glm::uvec2 ntiles;
+    std::vector<uint8_t> tile_done;
+
+    size_t tile_offset(const size_t tile_id) const;
+
+public:
+    // Open the file, resuming it if it exists and has the same dimensions and tile size,
+    // otherwise a new empty image is created
+    TiledImageFile(const std::string &fname,
+                   const glm::uvec2 &dims,
+                   const glm::uvec2 &tile_size);
+
+    TiledImageFile(const TiledImageFile &) = delete;
+    TiledImageFile &operator=(const TiledImageFile &) = delete;
+
+    const glm::uvec2 &dimensions() const;
+
+    const glm::uvec2 &tile_dimensions() const;
+
+    // The number of tiles along x and y
+    const glm::uvec2 &tile_count() const;
+
+    size_t num_tiles() const;
+
+    size_t tiles_remaining();
+
+    bool is_tile_done(const size_t tile_id);
+
+    // Write the tile's pixels and mark it done. The pixels are row-major with a stride of
+    // the tile width, tiles at the right and bottom edges of the image are cropped
+    void write_tile(const size_t tile_id, const uint32_t *pixels);
+
+    // Write the finished image out as a binary PPM, reading back a row of tiles at a time.
+    // Returns false if some tiles haven't been rendered yet or the file can't be written
+    bool write_ppm(const std::string &fname);
+};
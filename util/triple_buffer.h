@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/* A lock-free triple buffer for passing the latest value from a single producer
+ * thread to a single consumer thread. The producer writes into its back buffer and
+ * publishes it, the consumer picks up the most recently published buffer, skipping any
+ * it missed. Neither side ever waits on the other.
+ */
+template <typename T>
+class TripleBuffer {
+    static const uint8_t INDEX_MASK = 0x3;
+    // Set on the shared index when it refers to a buffer the consumer hasn't picked up yet
+    static const uint8_t FRESH_BIT = 0x4;
+
+    std::array<T, 3> buffers;
+    uint8_t back = 0;
+    std::atomic<uint8_t> shared;
+    uint8_t front = 2;
+
+public:
+    TripleBuffer() : shared(1) {}
+
+    TripleBuffer(const TripleBuffer &) = delete;
+    TripleBuffer &operator=(const TripleBuffer &) = delete;
+
+    // The buffer owned by the producer to write the next value into. Note that it
+    // holds a stale value from an earlier publish, not the last one written
+    T &back_buffer()
+    {
+        return buffers[back];
+    }
+
+    // Publish the back buffer to the consumer and take the shared buffer to write into next
+    void publish()
+    {
+        back = shared.exchange(back | FRESH_BIT, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // Swap in the most recently published buffer, returns false if nothing new has been
+    // published since the last update
+    bool update()
+    {
+        if (!(shared.load(std::memory_order_relaxed) & FRESH_BIT)) {
+            return false;
+        }
+        front = shared.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    // The buffer owned by the consumer, holding the latest value it picked up
+    T &front_buffer()
+    {
+        return buffers[front];
+    }
+};